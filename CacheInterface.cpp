@@ -14,6 +14,7 @@ static const int PAD_reply = sizeof(NodeKey);  // Assume this is bigger
 
 EntryTypeGravityParticle::EntryTypeGravityParticle() {
   CkCacheFillMsg<KeyType> msg(0);
+  nRequests = 0;
 }
 
 /// @param idx Index of the TreePiece
@@ -27,6 +28,7 @@ void * EntryTypeGravityParticle::request(CkArrayIndexMax& idx, KeyType key) {
   *(int*)CkPriorityPtr(msg) = -100000000;
   CkSetQueueing(msg, CK_QUEUEING_IFIFO);
   treeProxy[*idx.data()].fillRequestParticles(msg);
+  nRequests++;
   return NULL;
 }
 
@@ -94,7 +96,123 @@ void TreePiece::fillRequestParticles(CkCacheRequestMsg<KeyType> *msg) {
 
 // Methods for "combiner" cache
 
+/// Writebacks waiting to be sent from this processor
+CpvStaticDeclare(SmoothFlushBuffer *, smoothFlushBuffer);
+
+void initSmoothFlushBuffer() {
+    CpvInitialize(SmoothFlushBuffer *, smoothFlushBuffer);
+    CpvAccess(smoothFlushBuffer) = new SmoothFlushBuffer;
+}
+
+/// @brief Total size in bytes of a list of fields.
+static int smoothCacheFieldBytes(const SmoothCacheField *fields, int nFields) {
+    int nBytes = 0;
+    for(int k = 0; k < nFields; k++)
+        nBytes += fields[k].size;
+    return nBytes;
+}
+
+/// @brief Copy fields of a particle into a packed record.
+static void packSmoothCacheFields(char *rec, const ExternalSmoothParticle *part,
+                                  const SmoothCacheField *fields, int nFields) {
+    for(int k = 0; k < nFields; k++) {
+        memcpy(rec, ((const char *) part) + fields[k].offset, fields[k].size);
+        rec += fields[k].size;
+    }
+}
+
+/// @brief Copy fields from a packed record into a particle.
+static void unpackSmoothCacheFields(ExternalSmoothParticle *part, const char *rec,
+                                    const SmoothCacheField *fields, int nFields) {
+    for(int k = 0; k < nFields; k++) {
+        memcpy(((char *) part) + fields[k].offset, rec, fields[k].size);
+        rec += fields[k].size;
+    }
+}
+
+static inline void appendBytes(std::vector<char> &data, const void *p, int n) {
+    data.insert(data.end(), (const char *) p, ((const char *) p) + n);
+}
+
+/// @brief Encode the updates in a cache entry for its owner.
+/// @param iOwner Index of the TreePiece the entry came from.
+/// @param cPart Cached data
+///
+/// Buckets and, if fields are declared, particles without updates are
+/// left out.
+void SmoothFlushBuffer::add(int iOwner, CacheSmoothParticle *cPart) {
+    SmoothFlushData &flush = pending[iOwner];
+    flush.nBuckets++;
+    std::vector<char> &data = flush.data;
+    const size_t iHeader = data.size();
+    int nRecords = 0;
+    appendBytes(data, &cPart->begin, sizeof(int));
+    appendBytes(data, &nRecords, sizeof(int));
+
+    std::vector<char> rec(cPart->nFieldBytes);
+    int j = 0;
+    for (int i=0; i < 1 + cPart->end - cPart->begin; ++i) {
+        if(cPart->partCached[i].iType == 0)
+            continue;
+        ExternalSmoothParticle part
+            = cPart->partCached[i].getExternalSmoothParticle();
+        if(cPart->fields == NULL) {
+            part.iBucketOff = i;
+            appendBytes(data, &part, sizeof(part));
+            nRecords++;
+            }
+        else {
+            packSmoothCacheFields(rec.data(), &part, cPart->fields,
+                                  cPart->nFields);
+            if(memcmp(rec.data(), &cPart->fieldsCached[j*cPart->nFieldBytes],
+                      cPart->nFieldBytes) != 0) {
+                appendBytes(data, &i, sizeof(int));
+                appendBytes(data, rec.data(), cPart->nFieldBytes);
+                nRecords++;
+                }
+            }
+        j++;
+	}
+    CkAssert(j == cPart->nActual);
+    if(nRecords == 0)
+        data.resize(iHeader);
+    else
+        memcpy(&data[iHeader + sizeof(int)], &nRecords, sizeof(int));
+}
+
+/// @brief Send one message to each TreePiece with pending writebacks.
+void SmoothFlushBuffer::flush() {
+    for(std::map<int, SmoothFlushData>::iterator it = pending.begin();
+        it != pending.end(); ++it) {
+        SmoothFlushData &flush = it->second;
+        int nBytes = flush.data.size();
+        SmoothFlushMsg *msg = new (nBytes, 8*sizeof(int)) SmoothFlushMsg;
+        msg->nBuckets = flush.nBuckets;
+        msg->nBytes = nBytes;
+        if(nBytes > 0)
+            memcpy(msg->data, flush.data.data(), nBytes);
+        *(int*)CkPriorityPtr(msg) = -10000000;
+        CkSetQueueing(msg, CK_QUEUEING_IFIFO);
+        treeProxy[it->first].flushSmoothParticles(msg);
+    }
+    pending.clear();
+}
+
+/// @brief Tell the smooth particle cache that a local TreePiece is
+/// done with a chunk.  When this is the last one, the cache writes
+/// the chunk back; the writebacks are merged into one message per
+/// owner TreePiece.
+void smoothCacheFinishedChunk(int chunk) {
+    SmoothFlushBuffer *buffer = CpvAccess(smoothFlushBuffer);
+    buffer->bHold = 1;
+    cacheSmoothPart.ckLocalBranch()->finishedChunk(chunk, 0);
+    buffer->bHold = 0;
+    buffer->flush();
+}
+
 EntryTypeSmoothParticle::EntryTypeSmoothParticle() {
+    params = NULL;
+    nRequests = 0;
 }
 
 void * EntryTypeSmoothParticle::request(CkArrayIndexMax& idx, KeyType key) {
@@ -102,6 +220,7 @@ void * EntryTypeSmoothParticle::request(CkArrayIndexMax& idx, KeyType key) {
   *(int*)CkPriorityPtr(msg) = -100000000;
   CkSetQueueing(msg, CK_QUEUEING_IFIFO);
   treeProxy[*idx.data()].fillRequestSmoothParticles(msg);
+  nRequests++;
   return NULL;
 }
 
@@ -122,15 +241,28 @@ void * EntryTypeSmoothParticle::unpack(CkCacheFillMsg<KeyType> *msg, int chunk,
     //  following is true.
     CkAssert(sizeof(extraSPHData) > sizeof(extraStarData));
     cParts->extraSPHCached = new extraSPHData[cParts->nActual];
+    CkAssert(params != NULL);
+    // The table is static, so it outlives the walk's parameters.
+    cParts->fields = params->smoothCacheFields(cParts->nFields);
+    cParts->nFieldBytes = smoothCacheFieldBytes(cParts->fields,
+                                                cParts->nFields);
+    cParts->fieldsCached = NULL;
+    if(cParts->fields != NULL)
+        cParts->fieldsCached = new char[cParts->nActual*cParts->nFieldBytes];
     // Expand External particles to full particles in cache
     int j = 0;
     for(int i = 0; i < nTotal; i++) {
         if(j < cParts->nActual && i == cPartsIn->partExt[j].iBucketOff) {
             cParts->partCached[i].extraData = &cParts->extraSPHCached[j];
             cPartsIn->partExt[j].getParticle(&cParts->partCached[i]);
-            CkAssert(TYPETest(&(cParts->partCached[i]),
-                              globalSmoothParams->iType));
-            globalSmoothParams->initSmoothCache(&(cParts->partCached[i]));	// Clear cached copy
+            CkAssert(TYPETest(&(cParts->partCached[i]), params->iType));
+            params->initSmoothCache(&(cParts->partCached[i]));	// Clear cached copy
+            if(cParts->fields != NULL) {
+                ExternalSmoothParticle part
+                    = cParts->partCached[i].getExternalSmoothParticle();
+                packSmoothCacheFields(&cParts->fieldsCached[j*cParts->nFieldBytes],
+                                      &part, cParts->fields, cParts->nFields);
+                }
             j++;
             }
         else {
@@ -141,42 +273,29 @@ void * EntryTypeSmoothParticle::unpack(CkCacheFillMsg<KeyType> *msg, int chunk,
     return (void*) cParts;
 }
 
-/// Send the message back to the original TreePiece.
+/// Send the updates back to the original TreePiece.  During
+/// smoothCacheFinishedChunk() they are held to be merged with the
+/// rest of the chunk.
 void EntryTypeSmoothParticle::writeback(CkArrayIndexMax& idx, KeyType k, void *data) {
-    CacheSmoothParticle *cPart = (CacheSmoothParticle *)data;
-    int total = sizeof(CacheSmoothParticle)
-	+ (cPart->nActual - 1)*sizeof(ExternalSmoothParticle);
-    CkCacheFillMsg<KeyType> *reply = new (total, 8*sizeof(int)) CkCacheFillMsg<KeyType>(cPart->key);
-    CacheSmoothParticle *rdata = (CacheSmoothParticle*)reply->data;
-    rdata->begin = cPart->begin;
-    rdata->end = cPart->end;
-    rdata->nActual = cPart->nActual;
-  
-    int j = 0;
-    for (int i=0; i < 1 + cPart->end - cPart->begin; ++i) {
-        if(cPart->partCached[i].iType != 0) {
-            rdata->partExt[j] = cPart->partCached[i].getExternalSmoothParticle();
-            rdata->partExt[j].iBucketOff = i;
-            j++;
-            }
-	}
-    CkAssert(j == cPart->nActual);
-    *(int*)CkPriorityPtr(reply) = -10000000;
-    CkSetQueueing(reply, CK_QUEUEING_IFIFO);
-    treeProxy[*idx.data()].flushSmoothParticles(reply);
+    SmoothFlushBuffer *buffer = CpvAccess(smoothFlushBuffer);
+    buffer->add(*idx.data(), (CacheSmoothParticle *)data);
+    if(!buffer->bHold)
+        buffer->flush();
 }
 
 void EntryTypeSmoothParticle::free(void *data) {
     CacheSmoothParticle *cPart = (CacheSmoothParticle *)data;
     delete[] cPart->partCached;
     delete[] cPart->extraSPHCached;
+    delete[] cPart->fieldsCached;
     delete cPart;
 }
 
 int EntryTypeSmoothParticle::size(void * data) {
     CacheSmoothParticle *cPart = (CacheSmoothParticle *)data;
     return sizeof(CacheSmoothParticle)
-	+ (cPart->nActual - 1)*sizeof(ExternalSmoothParticle);
+	+ (cPart->nActual - 1)*sizeof(ExternalSmoothParticle)
+	+ cPart->nActual*cPart->nFieldBytes;
 }
 
 void EntryTypeSmoothParticle::callback(CkArrayID requestorID, CkArrayIndexMax &requestorIdx, KeyType key, CkCacheUserData &userData, void *data, int chunk) {
@@ -307,28 +426,56 @@ void TreePiece::fillRequestSmoothParticles(CkCacheRequestMsg<KeyType> *msg) {
 /// Combine cached copies with the originals on the treepiece.
 /// This function also decrements the count of outstanding cache
 /// accesses and does a check to see if the smooth walk is finished.
-void TreePiece::flushSmoothParticles(CkCacheFillMsg<KeyType> *msg) {
+///
+/// The message holds, for each bucket with updates, the index of its
+/// first particle and the number of updated particles, followed by
+/// the particles.  Each is either a whole ExternalSmoothParticle, or
+/// its offset in the bucket followed by the fields declared by
+/// SmoothParams::smoothCacheFields().
+void TreePiece::flushSmoothParticles(SmoothFlushMsg *msg) {
   
-  CacheSmoothParticle *data = (CacheSmoothParticle*)msg->data;
   SmoothCompute *sc = sSmooth;
   
   CkAssert(sc != NULL);
-  CkAssert(nCacheAccesses > 0);
-  
-  int j = 0;
-  for(int i = data->begin; j < data->nActual && i <= data->end; i++) {
-      while(data->partExt[j].iBucketOff > i - data->begin)
-          i++;
-      // Only do the type check if we are smoothing over a "base"
-      // type.  Other types (e.g. DELETED) can change over the smaooth
-      // operation.
-      if(sc->params->iType & (TYPE_DARK|TYPE_GAS|TYPE_STAR))
-          CkAssert(TYPETest(&myParticles[i], sc->params->iType));
-      sc->params->combSmoothCache(&myParticles[i], &data->partExt[j]);
-      j++;
+  CkAssert(nCacheAccesses >= msg->nBuckets);
+
+  int nFields;
+  const SmoothCacheField *fields = sc->params->smoothCacheFields(nFields);
+  const int nFieldBytes = smoothCacheFieldBytes(fields, nFields);
+
+  const char *data = msg->data;
+  const char *dataEnd = msg->data + msg->nBytes;
+  while(data < dataEnd) {
+      int begin, nRecords;
+      memcpy(&begin, data, sizeof(int));
+      memcpy(&nRecords, data + sizeof(int), sizeof(int));
+      data += 2*sizeof(int);
+      for(int j = 0; j < nRecords; j++) {
+          ExternalSmoothParticle part;
+          int iBucketOff;
+          if(fields == NULL) {
+              memcpy(&part, data, sizeof(part));
+              iBucketOff = part.iBucketOff;
+              data += sizeof(part);
+              }
+          else {
+              memcpy(&iBucketOff, data, sizeof(int));
+              unpackSmoothCacheFields(&part, data + sizeof(int), fields,
+                                      nFields);
+              data += sizeof(int) + nFieldBytes;
+              }
+          int i = begin + iBucketOff;
+          // Only do the type check if we are smoothing over a "base"
+          // type.  Other types (e.g. DELETED) can change over the smaooth
+          // operation.
+          if(sc->params->iType & (TYPE_DARK|TYPE_GAS|TYPE_STAR))
+              CkAssert(TYPETest(&myParticles[i], sc->params->iType));
+          sc->params->combSmoothCache(&myParticles[i], &part);
+          }
   }
+  CkAssert(data == dataEnd);
   
-  nCacheAccesses--;
+  nCacheAccesses -= msg->nBuckets;
   delete msg;
 
   if(sSmoothState->bWalkDonePending)
@@ -343,6 +490,7 @@ EntryTypeGravityNode::EntryTypeGravityNode() {
   // Note that this is compiler dependent; also note that it is unused
   // at the moment -- see unpackSingle() below.
   memcpy((void *)&vptr, (void *)&node, sizeof(void*));
+  nRequests = 0;
 }
 
 void * EntryTypeGravityNode::request(CkArrayIndexMax& idx, KeyType key) {
@@ -351,6 +499,7 @@ void * EntryTypeGravityNode::request(CkArrayIndexMax& idx, KeyType key) {
   CkSetQueueing(msg, CK_QUEUEING_IFIFO);
 
   treeProxy[*idx.data()].fillRequestNode(msg);
+  nRequests++;
   return NULL;
 }
 
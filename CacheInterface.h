@@ -7,12 +7,17 @@
  *  cache for requesting off processor particle and node data.
  */
 
+#include <map>
+#include <vector>
 #include <CkCache.h>
 #include "config.h"
 #include "gravity.h"
 #include "GenericTreeNode.h"
 #include "keytype.h"
 
+class SmoothParams;
+struct SmoothCacheField;
+
 /*********************************************************
  * Gravity interface: Particles
  *********************************************************/
@@ -36,6 +41,10 @@ public:
 /// This is a read-only cache of particles.
 class EntryTypeGravityParticle : public CkCacheEntryType<KeyType> {
 public:
+  /// @brief Number of fills requested for the owning TreePiece.
+  /// The cache only calls request() on the first miss of a key.
+  int nRequests;
+
   EntryTypeGravityParticle();
   /// @brief Request a bucket of particles from a TreePiece.
   void * request(CkArrayIndexMax&, KeyType);
@@ -65,14 +74,53 @@ public:
     KeyType key; ///< Key of this bucket (for writeback)
     GravityParticle *partCached;        ///< particle data
     extraSPHData *extraSPHCached;       ///< particle extraData
+    /// Fields written back, see SmoothParams::smoothCacheFields();
+    /// NULL for whole particles.
+    const SmoothCacheField *fields;
+    int nFields;
+    int nFieldBytes;    ///< Size of the fields of one particle
+    /// Fields of each actual particle as they were after
+    /// initSmoothCache(), to find those that were updated.
+    char *fieldsCached;
     ExternalSmoothParticle partExt[1];  ///< particle data in the message
 };
 
+/// @brief Writebacks of the smooth particle cache waiting to be sent
+/// to one TreePiece.
+class SmoothFlushData {
+public:
+    int nBuckets;               ///< Number of cache entries written back
+    std::vector<char> data;     ///< Encoded updates, see TreePiece::flushSmoothParticles()
+    SmoothFlushData() : nBuckets(0) {}
+};
+
+/// @brief Per processor buffer of smooth cache writebacks.  While the
+/// cache writes back a chunk, updates are merged so that each owner
+/// TreePiece receives a single message.
+class SmoothFlushBuffer {
+public:
+    int bHold;  ///< Keep writebacks until flush() is called
+    std::map<int, SmoothFlushData> pending;    ///< Indexed by TreePiece
+    SmoothFlushBuffer() : bHold(0) {}
+    void add(int iOwner, CacheSmoothParticle *cPart);
+    void flush();
+};
+
+void smoothCacheFinishedChunk(int chunk);
+
 /// @brief Cache interface to the particles for smooth calculations.
 /// This cache is a writeback cache.
 class EntryTypeSmoothParticle : public CkCacheEntryType<KeyType> {
-    // N.B. can't have helpful attributes because of the static function.
 public:
+  /// @brief Parameters of the smooth walk making the requests, or
+  /// NULL between walks.  Each TreePiece has its own entry type, and
+  /// the cache unpacks a fill with the entry type of the first
+  /// request for it.  All TreePieces on a processor share one cache,
+  /// so walks sharing a cache session must do the same smooth pass.
+  SmoothParams *params;
+  /// @brief Number of fills requested for the owning TreePiece.
+  int nRequests;
+
   EntryTypeSmoothParticle();
   /// @brief Request a bucket of particles from a TreePiece.
   void * request(CkArrayIndexMax&, KeyType);
@@ -98,6 +146,9 @@ class EntryTypeGravityNode : public CkCacheEntryType<KeyType> {
 	      // It's use will be compiler dependent.
   void unpackSingle(CkCacheFillMsg<KeyType> *, Tree::BinaryTreeNode *, int, CkArrayIndexMax &, bool);
 public:
+  /// @brief Number of fills requested for the owning TreePiece.
+  int nRequests;
+
   EntryTypeGravityNode();
   void * request(CkArrayIndexMax&, KeyType);
   void * unpack(CkCacheFillMsg<KeyType> *, int, CkArrayIndexMax &);
@@ -456,6 +456,13 @@ void DataManager::resetReadOnly(Parameters param, const CkCallback &cb)
     verbosity = param.iVerbosity;
     dExtraStore = param.dExtraStore;
     dMaxBalance = param.dMaxBalance;
+    bLBIncremental = param.bLBIncremental;
+    dLBMaxMigrate = param.dLBMaxMigrate;
+    bSmoothReuse = param.bSmoothReuse;
+    dSmoothSkin = param.dSmoothSkin;
+    bSnapKeyBox = param.bSnapKeyBox;
+    iSphKernel = param.iSPHKernel;
+    bSphKernelTable = param.bSPHKernelTable;
     dFracLoadBalance = param.dFracLoadBalance;
     nIOProcessor = param.nIOProcessor;
     theta = param.dTheta;
@@ -0,0 +1,84 @@
+/// @file ExtraDataPool.h
+/// Reuse of the gas and star extra data arrays of TreePieces.
+#ifndef _EXTRADATAPOOL_H
+#define _EXTRADATAPOOL_H
+
+#include <deque>
+#include "GravityParticle.h"
+
+/// @brief Per processor cache of released extraSPHData or
+/// extraStarData arrays.
+///
+/// Every domain decomposition frees the extra data arrays of each
+/// TreePiece and then allocates new ones of about the same size.
+/// Arrays given back to the pool are handed out again instead of
+/// going back to the heap, so long runs do not fragment memory.  The
+/// pool is kept from one decomposition to the next and holds at most
+/// nMaxBytes; the oldest arrays are freed first.  Arrays are plain
+/// new[] allocations: the pool neither compacts them nor gives out
+/// handles that stay valid once an array is given back.
+template <class T>
+class ExtraDataPool {
+    struct Block {
+        T *p;
+        int n;
+    };
+    std::deque<Block> blocks;
+    /// Bytes held in blocks
+    size_t nBytes;
+
+ public:
+    /// Most bytes of released arrays kept for reuse
+    static const size_t nMaxBytes = 64*1024*1024;
+
+    ExtraDataPool() : nBytes(0) {}
+
+    /// @brief Get an array of at least n elements.
+    /// @param n Number of elements wanted; on return, the number
+    /// of elements in the array.
+    /// @return NULL if n is not positive.
+    T *take(int &n) {
+        if(n <= 0) {
+            n = 0;
+            return NULL;
+        }
+        int iBest = -1;
+        for(int i = 0; i < (int) blocks.size(); i++) {
+            // Don't hand out an array more than 1/8 larger than needed.
+            if(blocks[i].n >= n && blocks[i].n - n <= n/8
+               && (iBest < 0 || blocks[i].n < blocks[iBest].n))
+                iBest = i;
+        }
+        if(iBest < 0)
+            return new T[n];
+        T *p = blocks[iBest].p;
+        n = blocks[iBest].n;
+        nBytes -= n*sizeof(T);
+        blocks.erase(blocks.begin() + iBest);
+        return p;
+    }
+
+    /// @brief Release an array of n elements obtained from take().
+    void give(T *p, int n) {
+        if(p == NULL)
+            return;
+        if(n*sizeof(T) > nMaxBytes) {
+            delete[] p;
+            return;
+        }
+        Block b = {p, n};
+        blocks.push_back(b);
+        nBytes += n*sizeof(T);
+        while(nBytes > nMaxBytes) {
+            nBytes -= blocks.front().n*sizeof(T);
+            delete[] blocks.front().p;
+            blocks.pop_front();
+        }
+    }
+};
+
+ExtraDataPool<extraSPHData> &gasDataPool();
+ExtraDataPool<extraStarData> &starDataPool();
+void initExtraDataPools();
+
+#endif
@@ -73,6 +73,8 @@ class extraSPHData
     double _PoverRho2;		/* Pressure/rho^2 */
     double _BalsaraSwitch;	/* Pressure/rho^2 */
     double _fBallMax;		/* Radius for inverse neighbor finding */
+    double _fSkinDrift;		/* Distance drifted since the last smooth skin reset */
+    double _fSkinBall;		/* Unlimited nSmooth neighbor radius of the last search */
 #ifdef CULLENALPHA
     double _CullenAlpha;        /* Alpha from Cullen & Dehnen 2010 */
     double _TimeDivV;           /* Time at which dvds was last updated */
@@ -136,6 +138,8 @@ class extraSPHData
     inline double& PoverRho2() {return _PoverRho2;}
     inline double& BalsaraSwitch() {return _BalsaraSwitch;}
     inline double& fBallMax() {return _fBallMax;}
+    inline double& fSkinDrift() {return _fSkinDrift;}
+    inline double& fSkinBall() {return _fSkinBall;}
 #ifdef CULLENALPHA
     inline double CullenAlpha() const {return _CullenAlpha;}
     inline double& CullenAlpha() {return _CullenAlpha;}
@@ -198,6 +202,13 @@ class extraSPHData
 	p | _PoverRho2;
 	p | _BalsaraSwitch;
 	p | _fBallMax;
+	// The smooth skin is not part of the checkpoint format.  An
+	// unpacked particle has no skin and gets a full neighbor search
+	// until the next full density pass records fSkinBall again.
+	if(p.isUnpacking()) {
+	    _fSkinDrift = 0.0;
+	    _fSkinBall = 0.0;
+	    }
 #ifdef CULLENALPHA
         p | _CullenAlpha;
         p | _TimeDivV;
@@ -315,17 +326,28 @@ class ExternalSmoothParticle;
 
 class GravityParticle : public ExternalGravityParticle {
 public:
-        Vector3D<cosmoType> velocity;
+        // Members are grouped by use so that the gravity walk, kick
+        // and drift only touch the first part of the particle: the
+        // walk reads the ExternalGravityParticle members above and
+        // updates the next group; kick and drift add rung, iType and
+        // velocity.  Smoothing and bookkeeping fields follow.
 	Vector3D<cosmoType> treeAcceleration;
 	cosmoType potential;
         cosmoType dtGrav;       ///< timestep from gravity; N.B., this
                                 ///  is actually stored as (1/time^2)
                                 ///  since the gravity calculation
                                 ///  naturally gives us (G M/R^3).
-        cosmoType fBall;           ///< Neighbor search radius for smoothing
-        cosmoType fDensity;
+        cosmoType interMass;
         int rung;  ///< the current rung (greater means faster)
         unsigned int iType;	///< Bitmask to hold particle type information
+        Vector3D<cosmoType> velocity;
+
+        cosmoType fBall;           ///< Neighbor search radius for smoothing
+        cosmoType fDensity;
+
+        SFC::Key key;
+        int64_t iOrder;	///< Input order of particles; unique particle ID
+	void *extraData;	/* SPH or Star particle data */
 #ifdef SIDMINTERACT
         int iNSIDMInteractions; // SIDM number of interactions
 #endif
@@ -335,11 +357,6 @@ public:
 #ifdef NEED_DT
         cosmoType dt;
 #endif
-        cosmoType interMass;
-
-        SFC::Key key;
-        int64_t iOrder;	///< Input order of particles; unique particle ID
-	void *extraData;	/* SPH or Star particle data */
 
 #if COSMO_STATS > 1
 	double intcellmass;
@@ -384,9 +401,8 @@ public:
 #endif
 
 // Debugging macros for the extra data fields.
-// To enable, define GP_DEBUG_EXTRAS
-
-#define GP_DEBUG_EXTRAS
+// To enable, define GP_DEBUG_EXTRAS (configure --enable-gp-debug-extras,
+// the default).  Production builds can disable the checks.
 
 #ifdef GP_DEBUG_EXTRAS
 /// Debugging macro to be sure you are accessing gas properties from a
@@ -425,6 +441,8 @@ public:
 	inline double& PoverRho2() { IMAGAS; return (((extraSPHData*)extraData)->PoverRho2());}
 	inline double& BalsaraSwitch() { IMAGAS; return (((extraSPHData*)extraData)->BalsaraSwitch());}
 	inline double& fBallMax() { IMAGAS; return (((extraSPHData*)extraData)->fBallMax());}
+	inline double& fSkinDrift() { IMAGAS; return (((extraSPHData*)extraData)->fSkinDrift());}
+	inline double& fSkinBall() { IMAGAS; return (((extraSPHData*)extraData)->fSkinBall());}
 #ifdef CULLENALPHA
         inline double CullenAlpha() const {IMAGAS; return (((extraSPHData*)extraData)->CullenAlpha());}
         inline double& CullenAlpha() {IMAGAS; return (((extraSPHData*)extraData)->CullenAlpha());}
@@ -10,6 +10,7 @@
 #include "HierarchOrbLB.h"
 
 #include "Orb3dLB_notopo.h"
+#include "LBCapture.h"
 
 #define  DEBUGF(x)      // CmiPrintf x;
 
@@ -43,6 +44,7 @@ HierarchOrbLB::HierarchOrbLB(const CkLBOptions &opt): CBase_HierarchOrbLB(opt) {
 #else
   orblb = (CentralLB *)AllocateOrb3dLB_notopo();
 #endif
+  ((Orb3dLB_notopo *)orblb)->bCapture = false;
 
   initTree();
 #endif
@@ -117,6 +119,7 @@ void HierarchOrbLB::work(LDStats* stats) {
   LevelData *lData = levelData[currentLevel];
 
   if (currentLevel == 1) {
+    LBCapture_Dump(stats, step(), lbname);
     orblb->work(stats);
   }
   else
@@ -52,6 +52,8 @@ void load_tipsy_gas(Tipsy::TipsyReader &r, GravityParticle &p, double dTuFac)
     p.vPred() = gp.vel;
     p.fBallMax() = FLT_MAX;     // N.B. don't use DOUBLE_MAX here:
                                 // fBallMax*fBallMax should not overflow.
+    p.fSkinDrift() = 0.0;
+    p.fSkinBall() = 0.0;
     p.fESNrate() = 0.0;
     p.fTimeCoolIsOffUntil() = 0.0;
     p.dTimeFB() = 0.0;
@@ -224,6 +226,7 @@ void TreePiece::loadTipsy(const std::string& filename,
 	// allocate an array for myParticles
 	nStore = (int)((myNumParticles + 2)*(1.0 + dExtraStore));
 	myParticles = new GravityParticle[nStore];
+	invalidateRungOrder();
 	// Are we loading SPH?
 	if(startParticle < nTotalSPH) {
 	    if(startParticle + myNumParticles <= nTotalSPH)
@@ -234,9 +237,7 @@ void TreePiece::loadTipsy(const std::string& filename,
 	else {
 	    myNumSPH = 0;
 	    }
-	nStoreSPH = (int)(myNumSPH*(1.0 + dExtraStore));
-	if(nStoreSPH > 0)
-	    mySPHParticles = new extraSPHData[nStoreSPH];
+	allocateGas();
 	// Are we loading stars?
 	if(startParticle + myNumParticles > nTotalSPH + nTotalDark) {
 	    if(startParticle <= nTotalSPH + nTotalDark)
@@ -340,6 +341,7 @@ void TreePiece::getMaxIOrds(const CkCallback& cb)
 void TreePiece::readTipsyArray(OutputParams& params, const CkCallback& cb)
 {
     params.dm = dm; // pass cooling information
+    invalidateRungOrder(); // in case this is a rung file
     FILE *infile = CmiFopen((params.fileName+"." + params.sTipsyExt).c_str(),
                             "r+");
     if(infile == NULL)
@@ -591,6 +593,8 @@ static void load_NC_gas(std::string filename, int64_t startParticle,
         myParts[i].extraData = &mySPHParts[i];
         myParts[i].fBallMax() = FLT_MAX;  // N.B. don't use DOUBLE_MAX here:
                                           // fBallMax*fBallMax should not overflow.
+        myParts[i].fSkinDrift() = 0.0;
+        myParts[i].fSkinBall() = 0.0;
         myParts[i].fESNrate() = 0.0;
         myParts[i].fTimeCoolIsOffUntil() = 0.0;
         myParts[i].dTimeFB() = 0.0;
@@ -850,6 +854,7 @@ void TreePiece::loadNChilada(const std::string& filename,
 	// allocate an array for myParticles
 	nStore = (int)((myNumParticles + 2)*(1.0 + dExtraStore));
 	myParticles = new GravityParticle[nStore];
+	invalidateRungOrder();
 	// Are we loading SPH?
 	if(startParticle < nTotalSPH) {
 	    if(startParticle + myNumParticles <= nTotalSPH)
@@ -860,9 +865,7 @@ void TreePiece::loadNChilada(const std::string& filename,
 	else {
 	    myNumSPH = 0;
 	    }
-	nStoreSPH = (int)(myNumSPH*(1.0 + dExtraStore));
-	if(nStoreSPH > 0)
-	    mySPHParticles = new extraSPHData[nStoreSPH];
+	allocateGas();
 	// Are we loading stars?
 	if(startParticle + myNumParticles > nTotalSPH + nTotalDark) {
 	    if(startParticle <= nTotalSPH + nTotalDark)
@@ -924,6 +927,7 @@ void TreePiece::readFloatBinary(OutputParams& params, int bParaRead,
     void *data;
     int64_t startParticle = nStartRead;
     params.dm = dm; // pass cooling information
+    invalidateRungOrder(); // in case this is a rung file
     
     if((params.iType & TYPE_GAS) && (myNumSPH > 0)) {
         data = readFieldData(params.fileName + "/gas/" + params.sNChilExt, fh,
@@ -1453,6 +1457,7 @@ void TreePiece::reOrder(int64_t _nMaxOrder, const CkCallback& cb)
     if (myNumParticles > 0) {
 	// Sort particles in iOrder
 	sort(myParticles+1, myParticles+myNumParticles+1, compIOrder);
+	invalidateRungOrder();
 
 	// Tag boundary particle to avoid overruns
 	myParticles[myNumParticles+1].iOrder = nMaxOrder+1;
@@ -1622,21 +1627,18 @@ void TreePiece::ioAcceptSortedParticles(ParticleShuffleMsg *shuffleMsg) {
     if (myNumParticles > 0) delete[] myParticles;
     nStore = (int) ((nTotal + 2)*(1.0 + dExtraStore));
     myParticles = new GravityParticle[nStore];
+    invalidateRungOrder();
     myNumParticles = nTotal;
     // reset for next time
     incomingParticlesArrived = 0;
     incomingParticlesSelf = false;
 
     myNumSPH = nSPH;
-    if (nStoreSPH > 0) delete[] mySPHParticles;
-    nStoreSPH = (int) (myNumSPH*(1.0 + dExtraStore));
-    if(nStoreSPH > 0)
-        mySPHParticles = new extraSPHData[nStoreSPH];
-    else
-        mySPHParticles = NULL;
+    freeGas();
+    allocateGas();
 
     myNumStar = nStar;
-    if(nStoreStar > 0) delete[] myStarParticles;
+    freeStars();
     allocateStars();
 
     int nPart = 0;
@@ -1674,6 +1676,7 @@ void TreePiece::ioAcceptSortedParticles(ParticleShuffleMsg *shuffleMsg) {
 	}
 
     sort(myParticles+1, myParticles+myNumParticles+1, compIOrder);
+    invalidateRungOrder();
     //signify completion with a reduction
     if(verbosity>1) ckout << thisIndex <<" contributing to ioAccept particles"
 			  <<endl;
@@ -3,6 +3,10 @@
 #include "IntraNodeLBManager.h"
 
 CpvDeclare(int, tpGravDone);
+/// Bucket walks (local walk plus one per remote chunk) still to be
+/// done by the TreePieces on this PE.  Read by the other PEs of the
+/// node to find the most loaded PE.
+CpvDeclare(int, tpGravRemaining);
 
 IntraNodeLBManager::IntraNodeLBManager(CkMigrateMessage *m) :
   CBase_IntraNodeLBManager(m) {
@@ -10,6 +14,8 @@ IntraNodeLBManager::IntraNodeLBManager(CkMigrateMessage *m) :
   tps_done_ = 0;
   CpvInitialize(int, tpGravDone );
   CpvAccess(tpGravDone) = 1;
+  CpvInitialize(int, tpGravRemaining );
+  CpvAccess(tpGravRemaining) = 0;
 }
 
 IntraNodeLBManager::IntraNodeLBManager(int dummy, CkGroupID gid) : 
@@ -18,22 +24,34 @@ IntraNodeLBManager::IntraNodeLBManager(int dummy, CkGroupID gid) :
   loc_mgr_[0] = gid;
   CpvInitialize(int, tpGravDone );
   CpvAccess(tpGravDone) = 1;
+  CpvInitialize(int, tpGravRemaining );
+  CpvAccess(tpGravRemaining) = 0;
 }
 
 
-void IntraNodeLBManager::registerTP() {
-  if (total_tps_ > 0) {
-    return;
+/// @brief Register a TreePiece starting its gravity walks.
+/// @param nWork number of bucket walks the TreePiece has to do.
+void IntraNodeLBManager::registerTP(int nWork) {
+  if (total_tps_ == 0) {
+    tps_done_ = 0;
+    CkCacheArrayCounter local_chares;
+    for (int i = 0; i < num_loc_mgr_; ++i) {
+      CkLocMgr *mgr = (CkLocMgr *)CkLocalBranch(loc_mgr_[i]);
+      mgr->iterate(local_chares);
+    }
+    total_tps_ = local_chares.count;
+    CpvAccess(tpGravRemaining) = 0;
+    CpvAccess(tpGravDone) = 0;
   }
+  CpvAccess(tpGravRemaining) += nWork;
+}
 
-  tps_done_ = 0;
-  CkCacheArrayCounter local_chares;
-  for (int i = 0; i < num_loc_mgr_; ++i) {
-    CkLocMgr *mgr = (CkLocMgr *)CkLocalBranch(loc_mgr_[i]);
-    mgr->iterate(local_chares);
+/// @brief Record that a TreePiece on this PE has done nWork bucket walks.
+void IntraNodeLBManager::workDone(int nWork) {
+  CpvAccess(tpGravRemaining) -= nWork;
+  if (CpvAccess(tpGravRemaining) < 0) {
+    CpvAccess(tpGravRemaining) = 0;
   }
-  total_tps_ = local_chares.count;
-  CpvAccess(tpGravDone) = 0;
 }
 
 void IntraNodeLBManager::finishedTPWork() {
@@ -44,6 +62,7 @@ void IntraNodeLBManager::finishedTPWork() {
   if (tps_done_ == total_tps_) {
     total_tps_ = 0;
     tps_done_ = 0;
+    CpvAccess(tpGravRemaining) = 0;
     CpvAccess(tpGravDone) = 1;
   }
 }
@@ -61,6 +80,24 @@ vector<int> IntraNodeLBManager::getOtherIdlePes() {
   return idlepes;
 }
 
+/// @brief Is this PE the one with the most gravity work left on the
+/// node?  Idle PEs pick up the CkLoop chunks of the most loaded PE
+/// first, which shortens the tail of the gravity walk.
+bool IntraNodeLBManager::isMostLoadedPe() {
+  int myRemaining = CpvAccess(tpGravRemaining);
+  if (myRemaining == 0) {
+    return false;
+  }
+  int nsize = CkNodeSize(CkMyNode());
+  for (int i = 0; i < nsize; i++) {
+    if ((CkNodeFirst(CkMyNode()) + i) != CkMyPe() &&
+        CpvAccessOther(tpGravRemaining, i) > myRemaining) {
+      return false;
+    }
+  }
+  return true;
+}
+
 void IntraNodeLBManager::pup(PUP::er &p) {
   CBase_IntraNodeLBManager::pup(p);
   p | num_loc_mgr_;
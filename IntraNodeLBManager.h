@@ -15,10 +15,12 @@ class IntraNodeLBManager : public CBase_IntraNodeLBManager {
 
   void pup(PUP::er &p);
  
-  void registerTP();
+  void registerTP(int nWork);
   void finishedTPWork();
+  void workDone(int nWork);
 
   vector<int> getOtherIdlePes();
+  bool isMostLoadedPe();
 
  private:
   int total_tps_;
@@ -0,0 +1,204 @@
+#include <charm++.h>
+#include "LBCapture.h"
+#include "ParallelGravity.h"
+#include "formatted_string.h"
+
+CkpvExtern(int, _lb_obj_index);
+
+/// @brief Record the LB database and the TreePiece user data.
+/// @param stats LB structure as handed to the strategy
+/// @param iStep LB step of this capture
+/// @param achStrategy name of the strategy
+void LBCapture::capture(BaseLB::LDStats *stats, int iStep,
+                        const char *achStrategy)
+{
+    strategy = achStrategy;
+    step = iStep;
+    numNodes = CkNumNodes();
+
+    procs.resize(stats->nprocs());
+    for(int i = 0; i < stats->nprocs(); i++) {
+        procs[i].pe = stats->procs[i].pe;
+        procs[i].available = stats->procs[i].available;
+        procs[i].total_walltime = stats->procs[i].total_walltime;
+        procs[i].idletime = stats->procs[i].idletime;
+        procs[i].bg_walltime = stats->procs[i].bg_walltime;
+    }
+
+    const int num_objs = stats->objData.size();
+    objs.resize(num_objs);
+    for(int i = 0; i < num_objs; i++) {
+        LDObjData &odata = stats->objData[i];
+        TaggedVector3D* udata =
+            (TaggedVector3D *)odata.getUserData(CkpvAccess(_lb_obj_index));
+        objs[i].migratable = odata.migratable;
+        objs[i].from_proc = stats->from_proc[i];
+        objs[i].wallTime = odata.wallTime;
+        objs[i].centroid = udata->vec;
+        objs[i].tp = udata->tp;
+        objs[i].tag = udata->tag;
+        objs[i].numActiveParticles = udata->numActiveParticles;
+        objs[i].myNumParticles = udata->myNumParticles;
+        if(CkpvAccess(_lb_comm_obj_index) != -1) {
+            TPCommData *cdata = (TPCommData *)
+                odata.getUserData(CkpvAccess(_lb_comm_obj_index));
+            objs[i].commPeer.assign(cdata->peer, cdata->peer + cdata->nPeers);
+            objs[i].commBytes.assign(cdata->bytes,
+                                     cdata->bytes + cdata->nPeers);
+        }
+    }
+}
+
+/// @brief Fill an LDStats with the captured database.  The user data
+/// pointers refer to storage in this object, so it must outlive stats.
+/// @param stats LB structure allocated with the captured number of
+/// processors.
+void LBCapture::restore(BaseLB::LDStats *stats)
+{
+    CkAssert(stats->nprocs() == (int) procs.size());
+    for(int i = 0; i < stats->nprocs(); i++) {
+        stats->procs[i].pe = procs[i].pe;
+        stats->procs[i].available = procs[i].available;
+        stats->procs[i].total_walltime = procs[i].total_walltime;
+        stats->procs[i].idletime = procs[i].idletime;
+        stats->procs[i].bg_walltime = procs[i].bg_walltime;
+    }
+
+    const int iUserData = CkpvAccess(_lb_obj_index);
+    CkMustAssert(iUserData != -1, "LB user data index not registered");
+
+    const int iCommData = CkpvAccess(_lb_comm_obj_index);
+
+    const int num_objs = objs.size();
+    userData.clear();
+    userData.reserve(num_objs);
+    commData.assign(num_objs, TPCommData());
+    stats->objData.resize(num_objs);
+    stats->from_proc.resize(num_objs);
+    stats->to_proc.resize(num_objs);
+    stats->n_migrateobjs = 0;
+    for(int i = 0; i < num_objs; i++) {
+        TaggedVector3D tv(objs[i].centroid, LDObjHandle(),
+                          objs[i].numActiveParticles, objs[i].myNumParticles,
+                          0, 0);
+        tv.tp = objs[i].tp;
+        tv.tag = objs[i].tag;
+        userData.push_back(tv);
+
+        LDObjData &odata = stats->objData[i];
+        odata.migratable = objs[i].migratable;
+        odata.wallTime = objs[i].wallTime;
+        while((int) odata.userData.size() <= iUserData)
+            odata.userData.push_back(NULL);
+        odata.userData[iUserData] = &userData[i];
+        if(iCommData != -1) {
+            int nPeers = std::min((int) objs[i].commPeer.size(),
+                                  LB_COMM_MAX_PEERS);
+            commData[i].nPeers = nPeers;
+            for(int k = 0; k < nPeers; k++) {
+                commData[i].peer[k] = objs[i].commPeer[k];
+                commData[i].bytes[k] = objs[i].commBytes[k];
+            }
+            while((int) odata.userData.size() <= iCommData)
+                odata.userData.push_back(NULL);
+            odata.userData[iCommData] = &commData[i];
+        }
+
+        stats->from_proc[i] = stats->to_proc[i] = objs[i].from_proc;
+        if(odata.migratable)
+            stats->n_migrateobjs++;
+    }
+}
+
+/// @brief Write the LB database to a text file for offline replay.
+/// @param stats LB structure
+/// @param iStep LB step
+/// @param achStrategy name of the strategy
+/// @param achFileName file to write.
+void write_LB_capture(BaseLB::LDStats *stats, int iStep,
+                      const char *achStrategy, const char *achFileName)
+{
+    LBCapture capture;
+    capture.capture(stats, iStep, achStrategy);
+
+    FILE *fp = fopen(achFileName, "w");
+    if(fp == NULL) {
+        CkError("WARNING: could not open LB capture file %s\n", achFileName);
+        return;
+    }
+    PUP::toTextFile ptf(fp);
+    capture.pup(ptf);
+    fclose(fp);
+}
+
+/// @brief Write a capture of the LB database if requested by the
+/// bLBCapture parameter.  This should be called when a strategy is
+/// entered, before it modifies stats.
+/// @param stats LB structure
+/// @param iStep LB step
+/// @param achStrategy name of the strategy, also used in the file name
+void LBCapture_Dump(BaseLB::LDStats *stats, int iStep,
+                    const char *achStrategy)
+{
+    if(!bLBCapture)
+        return;
+    auto achFileName = make_formatted_string("lb_capture.%s.%d.%d.dat",
+                                             achStrategy, iStep, CkMyPe());
+    write_LB_capture(stats, iStep, achStrategy, achFileName.c_str());
+}
+
+/// @brief Read an LB capture written by write_LB_capture().
+/// @return false if the file could not be opened.
+bool read_LB_capture(LBCapture &capture, const char *achFileName)
+{
+    FILE *fp = fopen(achFileName, "r");
+    if(fp == NULL)
+        return false;
+    PUP::fromTextFile pff(fp);
+    capture.pup(pff);
+    fclose(fp);
+    return true;
+}
+
+/// @brief Summarize the decision a strategy made on an LDStats:
+/// predicted processor loads, migration volume and decision time.
+/// @param stats LB structure after the strategy has set to_proc
+/// @param achStrategy name of the strategy for the printout
+/// @param dDecisionTime wall time spent in the strategy
+void LBCapture_PrintEval(BaseLB::LDStats *stats, const char *achStrategy,
+                         double dDecisionTime)
+{
+    const int nprocs = stats->nprocs();
+    std::vector<double> predLoad(nprocs, 0.0);
+    for(int i = 0; i < nprocs; i++)
+        predLoad[i] = stats->procs[i].bg_walltime;
+
+    const int iUserData = CkpvAccess(_lb_obj_index);
+    int nMigrated = 0;
+    int64_t nPartMigrated = 0;
+    const int num_objs = stats->objData.size();
+    for(int i = 0; i < num_objs; i++) {
+        TaggedVector3D* udata =
+            (TaggedVector3D *)stats->objData[i].getUserData(iUserData);
+        predLoad[stats->to_proc[i]] += stats->objData[i].wallTime;
+        if(stats->to_proc[i] != stats->from_proc[i]) {
+            nMigrated++;
+            nPartMigrated += udata->myNumParticles;
+        }
+    }
+
+    double maxPred = 0.0;
+    double avgPred = 0.0;
+    for(int i = 0; i < nprocs; i++) {
+        avgPred += predLoad[i];
+        if(predLoad[i] > maxPred) maxPred = predLoad[i];
+    }
+    avgPred /= nprocs;
+
+    CkPrintf("%s: maxPred %g avgPred %g maxPred/avgPred %g\n", achStrategy,
+             maxPred, avgPred, (avgPred > 0.0 ? maxPred/avgPred : 0.0));
+    CkPrintf("%s: migrated %d objects %ld particles (~%g MB)\n", achStrategy,
+             nMigrated, (long) nPartMigrated,
+             nPartMigrated*sizeof(GravityParticle)/(1024.0*1024.0));
+    CkPrintf("%s: decision time %g s\n", achStrategy, dDecisionTime);
+}
@@ -0,0 +1,106 @@
+/// @file LBCapture.h
+/// Capture of the load balancing database for offline replay of the
+/// ChaNGa load balancing strategies.  See lbreplay/README.
+#ifndef _LBCAPTURE_H
+#define _LBCAPTURE_H
+
+#include <string>
+#include <vector>
+#include "CentralLB.h"
+#include "pup_stl.h"
+#include "TaggedVector3D.h"
+#include "MultistepCommLB.h"
+
+/// @brief Per processor information recorded in an LB capture.
+class LBCaptureProc {
+ public:
+    int pe;
+    int available;
+    double total_walltime;
+    double idletime;
+    double bg_walltime;
+
+    LBCaptureProc() : pe(-1), available(1), total_walltime(0.0),
+                      idletime(0.0), bg_walltime(0.0) {}
+    void pup(PUP::er &p) {
+        p|pe;
+        p|available;
+        p|total_walltime;
+        p|idletime;
+        p|bg_walltime;
+    }
+};
+
+/// @brief Per object (TreePiece) information recorded in an LB capture.
+/// This is the LB database entry plus the TaggedVector3D user data.
+class LBCaptureObj {
+ public:
+    int migratable;
+    int from_proc;
+    double wallTime;
+    Vector3D<float> centroid;
+    int tp;
+    int tag;
+    int numActiveParticles;
+    int myNumParticles;
+    /// Cache fill peers and bytes (MultistepCommLB only)
+    std::vector<int> commPeer;
+    std::vector<float> commBytes;
+
+    LBCaptureObj() : migratable(0), from_proc(-1), wallTime(0.0), tp(-1),
+                     tag(-1), numActiveParticles(0), myNumParticles(0) {}
+    void pup(PUP::er &p) {
+        p|migratable;
+        p|from_proc;
+        p|wallTime;
+        p|centroid;
+        p|tp;
+        p|tag;
+        p|numActiveParticles;
+        p|myNumParticles;
+        p|commPeer;
+        p|commBytes;
+    }
+};
+
+/// @brief Snapshot of the load balancing database taken as a strategy
+/// is entered.  It is written with PUP::toTextFile and can be read
+/// back with PUP::fromTextFile to rebuild an equivalent LDStats.
+class LBCapture {
+ public:
+    /// Strategy that was handed the database
+    std::string strategy;
+    /// LB step at which the capture was taken
+    int step;
+    /// Number of nodes in the run that was captured
+    int numNodes;
+    std::vector<LBCaptureProc> procs;
+    std::vector<LBCaptureObj> objs;
+    /// Storage for the user data attached to a restored LDStats
+    std::vector<TaggedVector3D> userData;
+    std::vector<TPCommData> commData;
+
+    LBCapture() : step(0), numNodes(0) {}
+    void capture(BaseLB::LDStats *stats, int iStep, const char *achStrategy);
+    void restore(BaseLB::LDStats *stats);
+    void pup(PUP::er &p) {
+        p|strategy;
+        p|step;
+        p|numNodes;
+        p|procs;
+        p|objs;
+    }
+};
+
+/// Write a capture at every load balancing step (bLBCapture parameter)
+extern int bLBCapture;
+
+void LBCapture_Dump(BaseLB::LDStats *stats, int iStep,
+                    const char *achStrategy);
+void write_LB_capture(BaseLB::LDStats *stats, int iStep,
+                      const char *achStrategy, const char *achFileName);
+bool read_LB_capture(LBCapture &capture, const char *achFileName);
+void LBCapture_PrintEval(BaseLB::LDStats *stats, const char *achStrategy,
+                         double dDecisionTime);
+
+#endif
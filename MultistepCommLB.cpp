@@ -0,0 +1,298 @@
+#include <charm++.h>
+#include "cklists.h"
+#include "MultistepCommLB.h"
+#include "LBCapture.h"
+#include "ParallelGravity.h"
+#include "Vector3D.h"
+#include <map>
+#include "formatted_string.h"
+
+CkpvExtern(int, _lb_obj_index);
+CkpvDeclare(int, _lb_comm_obj_index);
+using namespace std;
+
+#if CHARM_VERSION > 61002
+static void lbinit()
+{
+    LBRegisterBalancer<MultistepCommLB>("MultistepCommLB",
+      "Works best with multistepped runs; uses Orb3D_notopo refined to reduce cross node cache traffic");
+}
+#else
+CreateLBFunc_Def(MultistepCommLB, "Works best with multistepped runs; uses Orb3D_notopo refined to reduce cross node cache traffic");
+#endif
+
+static void lbcomminit()
+{
+    CkpvInitialize(int, _lb_comm_obj_index);
+    CkpvAccess(_lb_comm_obj_index) = -1;
+}
+
+void MultistepCommLB::init() {
+  lbname = "MultistepCommLB";
+  if (CkpvAccess(_lb_obj_index) == -1)
+    CkpvAccess(_lb_obj_index) = LBRegisterObjUserData(sizeof(TaggedVector3D));
+  if (CkpvAccess(_lb_comm_obj_index) == -1)
+    CkpvAccess(_lb_comm_obj_index) = LBRegisterObjUserData(sizeof(TPCommData));
+}
+
+MultistepCommLB::MultistepCommLB(const CkLBOptions &opt): CBase_MultistepCommLB(opt)
+{
+  init();
+  if (CkMyPe() == 0){
+    CkPrintf("[%d] MultistepCommLB created\n",CkMyPe());
+  }
+}
+
+bool MultistepCommLB::QueryBalanceNow(int step){
+ if(CkMyPe() == 0) CkPrintf("MultistepCommLB: Step %d\n", step);
+ return true;
+}
+
+/// @brief Implement load balancing: store loads and determine active
+/// processors and objects, then call ORB3D and the communication
+/// refinement.
+void MultistepCommLB::work(BaseLB::LDStats* stats)
+{
+#if CMK_LBDB_ON
+  // find active objects - mark the inactive ones as non-migratable
+  const auto num_objs = stats->objData.size();
+
+  LBCapture_Dump(stats, step(), lbname);
+
+  if(_lb_args.debug() >= 2 && step() > 0) {
+      // Write out "particle file" of measured load balance information
+      auto achFileName = make_formatted_string("lb_a.%d.sim", step()-1);
+      write_LB_particles(stats, achFileName.c_str(), true);
+  }
+
+  int numActiveObjects = 0;
+  int numInactiveObjects = 0;
+
+  for(int i = 0; i < num_objs; i++){
+    stats->to_proc[i] = stats->from_proc[i];
+  }
+
+  for(int i = 0; i < num_objs; i++){
+    if (!stats->objData[i].migratable) continue;
+
+    LDObjData &odata = stats->objData[i];
+    TaggedVector3D* udata = (TaggedVector3D *)odata.getUserData(CkpvAccess(_lb_obj_index));
+
+    if(udata->myNumParticles == 0){ // ignore pieces with no particles
+        stats->objData[i].migratable = 0;
+        stats->n_migrateobjs--;
+        continue;
+    }
+    if(udata->numActiveParticles == 0){
+      numInactiveObjects++;
+    }
+    else{
+      numActiveObjects++;
+    }
+  }
+  CkPrintf("numActiveObjects: %d, numInactiveObjects: %d\n", numActiveObjects,
+      numInactiveObjects);
+  if(numActiveObjects < 0.1*numInactiveObjects) {
+    // only a small number of active objects, only migrate them
+    for(int i = 0; i < num_objs; i++){
+      if (!stats->objData[i].migratable) continue;
+
+      LDObjData &odata = stats->objData[i];
+      TaggedVector3D* udata =
+        (TaggedVector3D *)odata.getUserData(CkpvAccess(_lb_obj_index));
+      if(udata->numActiveParticles == 0) {
+          stats->objData[i].migratable = 0;
+          stats->n_migrateobjs--;
+      }
+    }
+  }
+
+  work2(stats, stats->nprocs());
+#endif //CMK_LDB_ON
+}
+
+/// @brief ORB3D load balance followed by communication refinement.
+void MultistepCommLB::work2(BaseLB::LDStats *stats, int count){
+  const int numobjs = stats->objData.size();
+  int nmig = stats->n_migrateobjs;
+
+  vector<OrbObject> tp_array;
+  tp_array.resize(nmig);
+
+  vector<Event> tpEvents[NDIMS];
+  for(int i = 0; i < NDIMS; i++){
+    tpEvents[i].reserve(nmig);
+  }
+
+  // load of every object, indexed by LB index
+  vector<float> objLoad(numobjs, 0.0);
+
+  OrientedBox<float> box;
+
+  int numProcessed = 0;
+
+  for(int i = 0; i < numobjs; i++){
+    LDObjData &odata = stats->objData[i];
+    TaggedVector3D* udata = (TaggedVector3D *)odata.getUserData(CkpvAccess(_lb_obj_index));
+    if(step() == 0){
+      objLoad[i] = udata->myNumParticles;
+    }
+    else{
+      objLoad[i] = stats->objData[i].wallTime;
+    }
+    if(!stats->objData[i].migratable) continue;
+
+    tpEvents[XDIM].push_back(Event(udata->vec.x,objLoad[i],numProcessed));
+    tpEvents[YDIM].push_back(Event(udata->vec.y,objLoad[i],numProcessed));
+    tpEvents[ZDIM].push_back(Event(udata->vec.z,objLoad[i],numProcessed));
+
+    tp_array[numProcessed]= OrbObject(i, udata->myNumParticles);
+    tp_array[numProcessed].centroid = udata->vec;
+    numProcessed++;
+  }
+  CkAssert(numProcessed==nmig);
+
+  if(nmig > 0) {
+    orbPrepare(tpEvents, box, nmig, stats);
+    orbPartition(tpEvents,box,stats->nprocs(),tp_array, stats);
+  }
+
+  commRefine(stats, objLoad);
+
+  refine(stats, numobjs);
+
+  if(_lb_args.debug() >= 2) {
+      // Write out "particle file" of load balance information
+      auto achFileName = make_formatted_string("lb.%d.sim", step());
+      write_LB_particles(stats, achFileName.c_str(), false);
+  }
+}
+
+/// @brief Greedily move migratable TreePieces to the node holding most
+/// of their cache traffic, subject to a load tolerance.
+/// @param stats LB structure; to_proc holds the starting assignment.
+/// @param objLoad Predicted load of each object.
+void MultistepCommLB::commRefine(BaseLB::LDStats *stats,
+                                 const vector<float> &objLoad){
+  const int numobjs = stats->objData.size();
+  const int nprocs = stats->nprocs();
+  const int iCommData = CkpvAccess(_lb_comm_obj_index);
+
+  // Map TreePiece index to LB index
+  int maxTP = -1;
+  for(int i = 0; i < numobjs; i++){
+    TaggedVector3D* udata =
+      (TaggedVector3D *)stats->objData[i].getUserData(CkpvAccess(_lb_obj_index));
+    maxTP = max(maxTP, udata->tp);
+  }
+  vector<int> tpToLB(maxTP + 1, -1);
+  for(int i = 0; i < numobjs; i++){
+    TaggedVector3D* udata =
+      (TaggedVector3D *)stats->objData[i].getUserData(CkpvAccess(_lb_obj_index));
+    if(udata->tp >= 0)
+      tpToLB[udata->tp] = i;
+  }
+
+  // Undirected communication graph: a cache fill in either direction
+  // costs the same when it crosses nodes.
+  vector<vector<pair<int, float> > > graph(numobjs);
+  int nEdges = 0;
+  for(int i = 0; i < numobjs; i++){
+    TPCommData *cdata =
+      (TPCommData *)stats->objData[i].getUserData(iCommData);
+    for(int k = 0; k < cdata->nPeers; k++){
+      if(cdata->peer[k] < 0 || cdata->peer[k] > maxTP) continue;
+      int j = tpToLB[cdata->peer[k]];
+      if(j < 0 || j == i) continue;
+      graph[i].push_back(make_pair(j, cdata->bytes[k]));
+      graph[j].push_back(make_pair(i, cdata->bytes[k]));
+      nEdges++;
+    }
+  }
+  if(nEdges == 0) {
+    CkPrintf("MultistepCommLB: no communication data\n");
+    return;
+  }
+
+  double dCrossBytesBefore = 0.0;
+  for(int i = 0; i < numobjs; i++){
+    for(auto &edge : graph[i]){
+      if(CkNodeOf(stats->to_proc[i]) != CkNodeOf(stats->to_proc[edge.first]))
+        dCrossBytesBefore += edge.second;
+    }
+  }
+
+  vector<double> peLoad(nprocs, 0.0);
+  double dTotalLoad = 0.0;
+  int nAvail = 0;
+  for(int i = 0; i < nprocs; i++){
+    peLoad[i] = stats->procs[i].bg_walltime;
+    if(stats->procs[i].available) nAvail++;
+  }
+  for(int i = 0; i < numobjs; i++){
+    peLoad[stats->to_proc[i]] += objLoad[i];
+  }
+  for(int i = 0; i < nprocs; i++){
+    dTotalLoad += peLoad[i];
+  }
+  if(nAvail == 0) return;
+  const double dMaxLoad = dCommLBTolerance*dTotalLoad/nAvail;
+
+  int nMoved = 0;
+  for(int iPass = 0; iPass < nCommLBPasses; iPass++){
+    int nPassMoved = 0;
+    for(int i = 0; i < numobjs; i++){
+      if(!stats->objData[i].migratable || graph[i].empty()) continue;
+
+      map<int, double> nodeBytes;
+      for(auto &edge : graph[i]){
+        nodeBytes[CkNodeOf(stats->to_proc[edge.first])] += edge.second;
+      }
+      int myNode = CkNodeOf(stats->to_proc[i]);
+      double dLocal = nodeBytes[myNode];
+      int bestNode = -1;
+      double dBest = dLocal;
+      for(auto &nb : nodeBytes){
+        if(nb.second > dBest){
+          dBest = nb.second;
+          bestNode = nb.first;
+        }
+      }
+      if(bestNode < 0) continue;
+
+      // least loaded processor on the best node
+      int bestPe = -1;
+      for(int pe = CkNodeFirst(bestNode);
+          pe < CkNodeFirst(bestNode) + CkNodeSize(bestNode) && pe < nprocs;
+          pe++){
+        if(!stats->procs[pe].available) continue;
+        if(bestPe < 0 || peLoad[pe] < peLoad[bestPe]) bestPe = pe;
+      }
+      if(bestPe < 0 || peLoad[bestPe] + objLoad[i] > dMaxLoad) continue;
+
+      peLoad[stats->to_proc[i]] -= objLoad[i];
+      peLoad[bestPe] += objLoad[i];
+      stats->to_proc[i] = bestPe;
+      nPassMoved++;
+    }
+    nMoved += nPassMoved;
+    if(nPassMoved == 0) break;
+  }
+
+  double dCrossBytesAfter = 0.0;
+  for(int i = 0; i < numobjs; i++){
+    for(auto &edge : graph[i]){
+      if(CkNodeOf(stats->to_proc[i]) != CkNodeOf(stats->to_proc[edge.first]))
+        dCrossBytesAfter += edge.second;
+    }
+  }
+  // Each edge is counted from both ends
+  CkPrintf("MultistepCommLB: %d edges, moved %d objects, cross node bytes %g -> %g\n",
+           nEdges, nMoved, 0.5*dCrossBytesBefore, 0.5*dCrossBytesAfter);
+}
+
+void MultistepCommLB::pup(PUP::er &p){
+  CBase_MultistepCommLB::pup(p);
+}
+
+#include "MultistepCommLB.def.h"
@@ -0,0 +1,67 @@
+/**
+ * \addtogroup CkLdb
+*/
+/*@{*/
+
+#ifndef _MULTISTEPCOMMLB_H_
+#define _MULTISTEPCOMMLB_H_
+
+#include "Orb3dLBCommon.h"
+
+#include "MultistepCommLB.decl.h"
+
+/// Maximum number of peers recorded per TreePiece for MultistepCommLB
+#define LB_COMM_MAX_PEERS 16
+
+/// @brief Sparse record of remote cache fills attached to each
+/// TreePiece as load balancer user data.
+///
+/// This holds the TreePieces from which this TreePiece fetched the
+/// most data on cache misses since the last load balancing, and an
+/// estimate of the number of bytes fetched from each.
+class TPCommData {
+ public:
+    int nPeers;
+    /// TreePiece index of each peer
+    int peer[LB_COMM_MAX_PEERS];
+    /// Bytes fetched from each peer
+    float bytes[LB_COMM_MAX_PEERS];
+
+    TPCommData() : nPeers(0) {}
+};
+
+CkpvExtern(int, _lb_comm_obj_index);
+
+/// @brief Multistep load balancer that also minimizes the remote
+/// cache traffic crossing node boundaries.
+///
+/// Like MultistepLB_notopo, TreePieces are first divided among
+/// processors by 3 dimensional ORB of their centroids using the
+/// measured load of the phase.  The assignment is then refined
+/// greedily: a TreePiece is moved to the node from which it (and its
+/// peers) fetch the most data through the cache, provided the
+/// receiving processor stays within a tolerance of the average load.
+/// The communication graph comes from the cache misses recorded by each
+/// TreePiece (see TPCommData).
+///
+class MultistepCommLB : public CBase_MultistepCommLB, public Orb3dCommon {
+private:
+  void init();
+  bool QueryBalanceNow(int step);
+
+public:
+  MultistepCommLB(const CkLBOptions &);
+  MultistepCommLB(CkMigrateMessage *m) : CBase_MultistepCommLB(m) {
+    init();
+  }
+
+  void work(BaseLB::LDStats* stats);
+  void work2(BaseLB::LDStats* stats, int count);
+  void commRefine(BaseLB::LDStats* stats, const std::vector<float> &objLoad);
+
+  void pup(PUP::er &p);
+};
+
+#endif /* _MULTISTEPCOMMLB_H_ */
+
+/*@}*/
@@ -1,6 +1,7 @@
 #include <charm++.h>
 #include "cklists.h"
 #include "MultistepLB.h"
+#include "LBCapture.h"
 #include "TopoManager.h"
 #include "ParallelGravity.h"
 #include "Vector3D.h"
@@ -130,6 +131,8 @@ void MultistepLB::work(BaseLB::LDStats* stats)
   int count;
   const auto numObjs = stats->objData.size();
 
+  LBCapture_Dump(stats, step(), lbname);
+
   int numActiveObjects = 0;
   int numInactiveObjects = 0;
 
@@ -1,5 +1,6 @@
 #include <charm++.h>
 #include "MultistepLB_SFC.h"
+#include "LBCapture.h"
 #include "ParallelGravity.h"
 #include "Vector3D.h"
 #include "formatted_string.h"
@@ -47,6 +48,8 @@ void MultistepLB_SFC::work(BaseLB::LDStats* stats)
     // find active objects - mark the inactive ones as non-migratable
     const auto num_objs = stats->objData.size();
 
+    LBCapture_Dump(stats, step(), lbname);
+
     if(_lb_args.debug() >= 2 && step() > 0) {
         // Write out "particle file" of measured load balance information
         auto achFileName = make_formatted_string("lb_a.%d.sim", step()-1);
@@ -1,10 +1,13 @@
 #include <charm++.h>
 #include "cklists.h"
 #include "MultistepLB_notopo.h"
+#include "LBCapture.h"
 #include "TopoManager.h"
 #include "ParallelGravity.h"
 #include "Vector3D.h"
 #include <queue>
+#include <set>
+#include <climits>
 #include "formatted_string.h"
 
 extern CProxy_TreePiece treeProxy;
@@ -67,6 +70,8 @@ void MultistepLB_notopo::work(BaseLB::LDStats* stats)
   int count;
   const auto num_objs = stats->objData.size();
 
+  LBCapture_Dump(stats, step(), lbname);
+
   if(_lb_args.debug() >= 2 && step() > 0) {
       // Write out "particle file" of measured load balance information
       auto achFileName = make_formatted_string("lb_a.%d.sim", step()-1);
@@ -353,6 +358,202 @@ void write_LB_particles(BaseLB::LDStats* stats, const char *achFileName, bool bF
     fclose(fp);
 }
 
+/// Load of a node or processor, relative to its share of the average,
+/// above which the incremental refinement moves work off of it.
+#define ORB_INCR_TOLERANCE 1.05
+
+/// Particle bytes of an object, charged to the migration budget.
+static double objBytes(BaseLB::LDStats *stats, int i)
+{
+    TaggedVector3D* udata = (TaggedVector3D *)
+        stats->objData[i].getUserData(CkpvAccess(_lb_obj_index));
+    return udata->myNumParticles*(double) sizeof(GravityParticle);
+}
+
+/// @brief Move objects from the most to the least loaded bin of a set of
+/// processors until all bins are within ORB_INCR_TOLERANCE of their
+/// share of the load or the migration budget is spent.
+///
+/// The bins are kept ordered by their load ratio, and the objects and
+/// available processors of each bin ordered by load, so each move
+/// costs O(log n).  Objects that do not fit into the remaining
+/// migration budget are dropped from consideration.
+/// @param stats LB structure; to_proc holds the current assignment.
+/// @param objLoad Predicted load of each object.
+/// @param peLoad Load of each processor; updated with the moves.
+/// @param pes Processors taking part.
+/// @param binOf Bin of each processor in pes.
+/// @param nBins Number of bins.
+/// @param objs Objects on the processors in pes.
+/// @param dBudget Migration bytes left; decreased by new migrations.
+/// @return number of objects moved.
+static int diffuseLoad(BaseLB::LDStats *stats, const vector<float> &objLoad,
+                       vector<double> &peLoad, const vector<int> &pes,
+                       const vector<int> &binOf, int nBins,
+                       const vector<int> &objs, double &dBudget)
+{
+    typedef set<pair<double, int> > LoadSet;
+    vector<double> binLoad(nBins, 0.0);
+    vector<int> binProcs(nBins, 0);
+    vector<LoadSet> binPes(nBins);
+    double dTotalLoad = 0.0;
+    int nAvail = 0;
+    for(int pe : pes) {
+        binLoad[binOf[pe]] += peLoad[pe];
+        dTotalLoad += peLoad[pe];
+        if(stats->procs[pe].available) {
+            binProcs[binOf[pe]]++;
+            binPes[binOf[pe]].insert(make_pair(peLoad[pe], pe));
+            nAvail++;
+        }
+    }
+    if(nAvail == 0 || dTotalLoad <= 0.0)
+        return 0;
+    const double dLoadPerProc = dTotalLoad/nAvail;
+
+    vector<LoadSet> binObjs(nBins);
+    for(int i : objs) {
+        if(stats->objData[i].migratable)
+            binObjs[binOf[stats->to_proc[i]]].insert(make_pair(objLoad[i], i));
+    }
+    // Bins ordered by load relative to their share
+    LoadSet binRatio;
+    for(int b = 0; b < nBins; b++) {
+        if(binProcs[b] > 0)
+            binRatio.insert(make_pair(binLoad[b]/(binProcs[b]*dLoadPerProc),
+                                      b));
+    }
+
+    int nMoved = 0;
+    for(int iMove = 0; iMove < objs.size() && binRatio.size() > 1; iMove++) {
+        if(binRatio.rbegin()->first <= ORB_INCR_TOLERANCE)
+            break;
+        int donor = binRatio.rbegin()->second;
+        int receiver = binRatio.begin()->second;
+
+        // Least loaded processor of the receiving bin
+        int toPe = binPes[receiver].begin()->second;
+        double dExcess = binLoad[donor] - binProcs[donor]*dLoadPerProc;
+        double dRoom = ORB_INCR_TOLERANCE*binProcs[receiver]*dLoadPerProc
+            - binLoad[receiver];
+        double dLimit = min(dExcess, dRoom);
+
+        // Largest object on the donor that fits both; objects that are
+        // already migrating are free to move again.
+        LoadSet &donorObjs = binObjs[donor];
+        auto it = donorObjs.upper_bound(make_pair(dLimit, INT_MAX));
+        int best = -1;
+        while(it != donorObjs.begin()) {
+            --it;
+            int i = it->second;
+            if(stats->to_proc[i] == stats->from_proc[i]
+               && objBytes(stats, i) > dBudget) {
+                it = donorObjs.erase(it);
+                continue;
+            }
+            best = i;
+            donorObjs.erase(it);
+            break;
+        }
+        if(best < 0)
+            break;
+
+        int fromPe = stats->to_proc[best];
+        if(fromPe == stats->from_proc[best])
+            dBudget -= objBytes(stats, best);
+        else if(toPe == stats->from_proc[best])
+            dBudget += objBytes(stats, best);
+
+        binRatio.erase(make_pair(binLoad[donor]/(binProcs[donor]*dLoadPerProc),
+                                 donor));
+        binRatio.erase(make_pair(binLoad[receiver]
+                                 /(binProcs[receiver]*dLoadPerProc), receiver));
+        if(stats->procs[fromPe].available) {
+            binPes[donor].erase(make_pair(peLoad[fromPe], fromPe));
+            binPes[donor].insert(make_pair(peLoad[fromPe] - objLoad[best],
+                                           fromPe));
+        }
+        binPes[receiver].erase(make_pair(peLoad[toPe], toPe));
+        binPes[receiver].insert(make_pair(peLoad[toPe] + objLoad[best], toPe));
+        peLoad[fromPe] -= objLoad[best];
+        binLoad[donor] -= objLoad[best];
+        peLoad[toPe] += objLoad[best];
+        binLoad[receiver] += objLoad[best];
+        binRatio.insert(make_pair(binLoad[donor]/(binProcs[donor]*dLoadPerProc),
+                                  donor));
+        binRatio.insert(make_pair(binLoad[receiver]
+                                  /(binProcs[receiver]*dLoadPerProc), receiver));
+        binObjs[receiver].insert(make_pair(objLoad[best], best));
+        stats->to_proc[best] = toPe;
+        nMoved++;
+    }
+    return nMoved;
+}
+
+/// @brief Incremental alternative to a fresh ORB: starting from the
+/// current assignment, diffuse load between nodes and then between the
+/// processors of each node, moving as few objects as possible.
+/// @param stats LB structure; to_proc is set on return.
+/// @param objLoad Predicted load of each object.
+/// @param dMaxMigrateBytes Bound on the particle bytes migrated; no
+/// bound if not positive.
+void Orb_IncrementalRefine(BaseLB::LDStats *stats, const vector<float> &objLoad,
+                           double dMaxMigrateBytes)
+{
+    const int nprocs = stats->nprocs();
+    const int num_objs = stats->objData.size();
+    double dBudget = (dMaxMigrateBytes > 0.0 ? dMaxMigrateBytes : HUGE_VAL);
+
+    vector<double> peLoad(nprocs, 0.0);
+    for(int pe = 0; pe < nprocs; pe++)
+        peLoad[pe] = stats->procs[pe].bg_walltime;
+    vector<int> objs(num_objs);
+    for(int i = 0; i < num_objs; i++) {
+        stats->to_proc[i] = stats->from_proc[i];
+        peLoad[stats->to_proc[i]] += objLoad[i];
+        objs[i] = i;
+    }
+
+    // Node level.  Processors are identified by stats->procs[].pe so
+    // this also works on the subsets seen by hierarchical strategies.
+    vector<int> pes(nprocs);
+    vector<int> nodeOf(nprocs);
+    int nNodes = 0;
+    for(int pe = 0; pe < nprocs; pe++) {
+        pes[pe] = pe;
+        nodeOf[pe] = CkNodeOf(stats->procs[pe].pe);
+        nNodes = max(nNodes, nodeOf[pe] + 1);
+    }
+    int nNodeMoved = diffuseLoad(stats, objLoad, peLoad, pes, nodeOf, nNodes,
+                                 objs, dBudget);
+
+    // Processor level within each node; each processor is its own bin.
+    vector<vector<int> > nodePes(nNodes);
+    vector<int> peIndex(nprocs);
+    for(int pe = 0; pe < nprocs; pe++) {
+        peIndex[pe] = nodePes[nodeOf[pe]].size();
+        nodePes[nodeOf[pe]].push_back(pe);
+    }
+    vector<vector<int> > nodeObjs(nNodes);
+    for(int i = 0; i < num_objs; i++)
+        nodeObjs[nodeOf[stats->to_proc[i]]].push_back(i);
+    int nPeMoved = 0;
+    for(int node = 0; node < nNodes; node++) {
+        if(nodePes[node].size() > 1)
+            nPeMoved += diffuseLoad(stats, objLoad, peLoad, nodePes[node],
+                                    peIndex, nodePes[node].size(),
+                                    nodeObjs[node], dBudget);
+    }
+
+    double dMigrated = 0.0;
+    for(int i = 0; i < num_objs; i++) {
+        if(stats->to_proc[i] != stats->from_proc[i])
+            dMigrated += objBytes(stats, i);
+    }
+    CkPrintf("[orbincr] moves %d between nodes %d within nodes, migrating %g MB\n",
+             nNodeMoved, nPeMoved, dMigrated/(1024.0*1024.0));
+}
+
 void MultistepLB_notopo::pup(PUP::er &p){
   CBase_MultistepLB_notopo::pup(p);
 }
@@ -1,6 +1,7 @@
 #include <charm++.h>
 #include "cklists.h"
 #include "MultistepNodeLB_notopo.h"
+#include "LBCapture.h"
 #include "TopoManager.h"
 #include "ParallelGravity.h"
 #include "Vector3D.h"
@@ -55,6 +56,8 @@ void MultistepNodeLB_notopo::work(BaseLB::LDStats* stats)
   int count;
   const auto num_objs = stats->objData.size();
 
+  LBCapture_Dump(stats, step(), lbname);
+
   if(_lb_args.debug() >= 2 && step() > 0) {
       // Write out "particle file" of measured load balance information
       auto achFileName = make_formatted_string("lb_a.%d.sim", step()-1);
@@ -1,7 +1,9 @@
 #include <charm++.h>
 #include "cklists.h"
 #include "Orb3dLB.h"
+#include "LBCapture.h"
 #include "ParallelGravity.h"
+#include "Orb3dLBCommon.h"
 #include "TopoManager.h"
 #include "Vector3D.h"
 
@@ -115,6 +117,8 @@ void Orb3dLB::work(BaseLB::LDStats* stats)
 {
   const int numobjs = stats->objData.size();
 
+  LBCapture_Dump(stats, step(), lbname);
+
   CkPrintf("[orb3dlb] %d objects allocating %lu bytes for tp\n", numobjs, numobjs*sizeof(TPObject));
   tps.resize(numobjs);
 
@@ -157,6 +161,16 @@ void Orb3dLB::work(BaseLB::LDStats* stats)
 
   }
 
+  if(bLBIncremental && step() > 0) {
+    // Diffuse from the current assignment rather than repartitioning
+    vector<float> objLoad(numobjs);
+    for(int i = 0; i < numobjs; i++)
+      objLoad[i] = stats->objData[i].wallTime;
+    Orb_IncrementalRefine(stats, objLoad, dLBMaxMigrate*1024.0*1024.0);
+    Orb_PrintLBStats(stats, numobjs);
+    return;
+  }
+
   mapping = &stats->to_proc;
   //mapping.resize(numobjs);
   int dim = 0;
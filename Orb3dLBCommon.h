@@ -18,6 +18,8 @@
 
 void Orb_PrintLBStats(BaseLB::LDStats *stats, int numobjs);
 void write_LB_particles(BaseLB::LDStats* stats, const char *achFileName, bool bFrom);
+void Orb_IncrementalRefine(BaseLB::LDStats *stats, const vector<float> &objLoad,
+                           double dMaxMigrateBytes);
 
 /// @brief Hold information about Pe load and number of objects.
 class PeInfo {
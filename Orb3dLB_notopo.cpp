@@ -1,6 +1,7 @@
 #include <charm++.h>
 #include "cklists.h"
 #include "Orb3dLB_notopo.h"
+#include "LBCapture.h"
 #include "ParallelGravity.h"
 #include "TopoManager.h"
 #include "Vector3D.h"
@@ -16,6 +17,7 @@ CkpvExtern(int, _lb_obj_index);
 
 void Orb3dLB_notopo::init() {
   lbname = "Orb3dLB_notopo";
+  bCapture = true;
   if (CkpvAccess(_lb_obj_index) == -1)
     CkpvAccess(_lb_obj_index) = LBRegisterObjUserData(sizeof(TaggedVector3D));
 }
@@ -52,6 +54,9 @@ void Orb3dLB_notopo::work(BaseLB::LDStats* stats)
   const int numobjs = stats->objData.size();
   double gstarttime = CkWallTimer();
 
+  if(bCapture && !doSimulateLB)
+    LBCapture_Dump(stats, step(), lbname);
+
   vector<Event> tpEvents[NDIMS];
   for(int i = 0; i < NDIMS; i++){
     tpEvents[i].reserve(numobjs);
@@ -111,8 +116,17 @@ void Orb3dLB_notopo::work(BaseLB::LDStats* stats)
     return;
   }
 
-  orbPrepare(tpEvents, box, numobjs, stats);
-  orbPartition(tpEvents,box,stats->nprocs(), tps, stats);
+  if(bLBIncremental && step() > 0) {
+    // Diffuse from the current assignment rather than repartitioning
+    vector<float> objLoad(numobjs);
+    for(int i = 0; i < numobjs; i++)
+      objLoad[i] = stats->objData[i].wallTime;
+    Orb_IncrementalRefine(stats, objLoad, dLBMaxMigrate*1024.0*1024.0);
+  }
+  else {
+    orbPrepare(tpEvents, box, numobjs, stats);
+    orbPartition(tpEvents,box,stats->nprocs(), tps, stats);
+  }
   int mcount = 0;
 	for(int i = 0; i < numobjs; i++) {
     if (stats->to_proc[i] != stats->from_proc[i]) {
@@ -31,6 +31,9 @@ private:
 //  int partitionRatioLoad(vector<Event> &events, float ratio);
 
 public:
+  /// Write an LB capture when bLBCapture is set; HierarchOrbLB
+  /// captures its own database instead.
+  bool bCapture;
   Orb3dLB_notopo(const CkLBOptions &);
   Orb3dLB_notopo(CkMigrateMessage *m): CBase_Orb3dLB_notopo(m) {init();}
   void work(BaseLB::LDStats* stats);
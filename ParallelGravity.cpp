@@ -103,6 +103,18 @@ double dExtraStore;		///< fraction of extra particle storage
 double dMaxBalance;		///< Max piece imbalance for load balancing
 double dFracLoadBalance;	///< Min fraction of particles active
                                 ///  for doing load balancing.
+double dLBLoadSmooth;		///< Weight of the latest measurement in
+                                ///  the per rung load model.
+int bLBIncremental;		///< Incremental ORB load balancing
+double dLBMaxMigrate;		///< Max MB migrated by incremental LB
+double dCommLBTolerance;	///< Max load of a PE receiving a TreePiece
+                                ///  in MultistepCommLB, relative to average
+int nCommLBPasses;		///< Refinement passes of MultistepCommLB
+int bSmoothReuse;		///< Reuse neighbor search buckets in ReSmooth
+double dSmoothSkin;		///< Skin fraction for bounded density searches
+int bSnapKeyBox;		///< Snap the key bounding box to a reusable grid
+int iSphKernel;			///< SPH kernel, see SphKernelType
+int bSphKernelTable;		///< Look the SPH kernel up in a table
 double dGlassDamper;    // Damping inverse timescale for making glasses
 int iGasModel; 			///< For backward compatibility
 int peanoKey;
@@ -183,6 +195,7 @@ enum GasModel {
 int doDumpLB;
 int lbDumpIteration;
 int doSimulateLB;
+int bLBCapture;
 
 /// Number of bins to use for the first iteration
 /// of every Oct decomposition step
@@ -228,6 +241,8 @@ Main::Main(CkArgMsg* m) {
 	bIsRestarting = 0;
         bHaveAlpha = 0;
 	bChkFirst = 1;
+	bSkinValid = 0;
+	nSkinSPH = 0;
 	dSimStartTime = CkWallTimer();
 
   int threadNum = CkMyNodeSize();
@@ -709,6 +724,50 @@ Main::Main(CkArgMsg* m) {
 	prmAddParam(prm,"dFracLoadBalance",paramDouble,&param.dFracLoadBalance,
 		    sizeof(double), "fraclb",
 		    "Minimum active particles for load balancing");
+	param.dLBLoadSmooth = 0.5;
+	prmAddParam(prm,"dLBLoadSmooth",paramDouble,&param.dLBLoadSmooth,
+		    sizeof(double), "lbsmooth",
+		    "Weight of latest measurement in smoothed per rung cost per active particle for load prediction (1 = no smoothing)");
+	param.bLBIncremental = 0;
+	prmAddParam(prm,"bLBIncremental",paramBool,&param.bLBIncremental,
+		    sizeof(int), "lbincr",
+		    "ORB balancers refine the previous assignment instead of repartitioning = -lbincr");
+	param.dLBMaxMigrate = 0.0;
+	prmAddParam(prm,"dLBMaxMigrate",paramDouble,&param.dLBMaxMigrate,
+		    sizeof(double), "lbmaxmig",
+		    "Maximum MB of particles migrated per incremental load balance (<= 0: no limit)");
+	param.dCommLBTolerance = 1.05;
+	prmAddParam(prm,"dCommLBTolerance",paramDouble,&param.dCommLBTolerance,
+		    sizeof(double), "commlbtol",
+		    "Maximum load, relative to the average, of a processor receiving a TreePiece in MultistepCommLB");
+	param.nCommLBPasses = 4;
+	prmAddParam(prm,"nCommLBPasses",paramInt,&param.nCommLBPasses,
+		    sizeof(int), "commlbpasses",
+		    "Number of communication refinement passes of MultistepCommLB");
+	param.bSmoothReuse = 0;
+	prmAddParam(prm,"bSmoothReuse",paramBool,&param.bSmoothReuse,
+		    sizeof(int), "smoothreuse",
+		    "ReSmooth visits the buckets found by the preceding neighbor search instead of walking the tree = -smoothreuse");
+	param.dSmoothSkin = 0.0;
+	prmAddParam(prm,"dSmoothSkin",paramDouble,&param.dSmoothSkin,
+		    sizeof(double), "smoothskin",
+		    "Skin, as a fraction of fBall, within which drifted gas reuses its last fBall to bound the density neighbor search (0 = off)");
+	param.bSnapKeyBox = 0;
+	prmAddParam(prm,"bSnapKeyBox",paramBool,&param.bSnapKeyBox,
+		    sizeof(int), "snapkeybox",
+		    "Snap the key bounding box to a power of two grid and assign keys during the drift while it stays valid = -snapkeybox");
+	param.dSmoothPredict = 0.0;
+	prmAddParam(prm,"dSmoothPredict",paramDouble,&param.dSmoothPredict,
+		    sizeof(double), "smoothpredict",
+		    "Safety factor on fBall predicted from divv as the initial density neighbor search radius (0 = off)");
+	param.iSPHKernel = SPH_KERNEL_DEFAULT;
+	prmAddParam(prm,"iSPHKernel",paramInt,&param.iSPHKernel,
+		    sizeof(int), "sphkernel",
+		    "SPH kernel: 0 M4, 1 M6, 2 Wendland C2, 3 Wendland C4, 4 Wendland C6 (default from configure)");
+	param.bSPHKernelTable = 0;
+	prmAddParam(prm,"bSPHKernelTable",paramBool,&param.bSPHKernelTable,
+		    sizeof(int), "sphkerneltable",
+		    "Interpolate the SPH kernel from a table instead of evaluating it = -sphkerneltable");
 	
 	bDumpFrame = 0;
 	df = NULL;
@@ -864,6 +923,10 @@ Main::Main(CkArgMsg* m) {
 
         CkAssert(!(doDumpLB && doSimulateLB));
 
+        bLBCapture = 0;
+        prmAddParam(prm, "bLBCapture", paramBool, &bLBCapture,
+              sizeof(int),"lbcapture", "Write LB database at every load balancing step for offline analysis");
+
     
           // jetley - cuda parameters
 #ifdef CUDA
@@ -977,6 +1040,26 @@ Main::Main(CkArgMsg* m) {
 	dExtraStore = param.dExtraStore;
 	dMaxBalance = param.dMaxBalance;
 	dFracLoadBalance = param.dFracLoadBalance;
+	dLBLoadSmooth = param.dLBLoadSmooth;
+	if(dLBLoadSmooth <= 0.0 || dLBLoadSmooth > 1.0) {
+	    ckerr << "WARNING: dLBLoadSmooth must be in (0, 1]; setting to 1"
+		  << endl;
+	    dLBLoadSmooth = 1.0;
+	    }
+	bLBIncremental = param.bLBIncremental;
+	dLBMaxMigrate = param.dLBMaxMigrate;
+	dCommLBTolerance = param.dCommLBTolerance;
+	nCommLBPasses = param.nCommLBPasses;
+	bSmoothReuse = param.bSmoothReuse;
+	dSmoothSkin = param.dSmoothSkin;
+	bSnapKeyBox = param.bSnapKeyBox;
+	if(param.iSPHKernel < 0 || param.iSPHKernel >= SPH_KERNEL_N) {
+	    ckerr << "iSPHKernel must be from 0 to " << SPH_KERNEL_N - 1
+		  << endl;
+	    CkAbort("Bad value for iSPHKernel");
+	    }
+	iSphKernel = param.iSPHKernel;
+	bSphKernelTable = param.bSPHKernelTable;
 	dGlassDamper = param.dGlassDamper;
 	_cacheLineDepth = param.cacheLineDepth;
 	verbosity = param.iVerbosity;
@@ -1180,12 +1263,11 @@ Main::Main(CkArgMsg* m) {
             param.bSphStep = 0;
             param.bDtAdjust = 0; // DtAdjust only affects gas
             }
-#if WENDLAND == 1
-        if(param.bDoGas && param.nSmooth < 32) {
+        if(param.bDoGas && param.nSmooth < 32
+           && param.iSPHKernel >= SPH_KERNEL_WENDLAND_C2) {
             ckerr << "WARNING: nSmooth < 32 with WENDLAND kernel." << endl;
             ckerr << "WARNING: M4 kernel with be used for smoothing." << endl;
             }
-#endif
 #include "physconst.h"
 	/*
 	 ** Convert kboltz/mhydrogen to system units, assuming that
@@ -1413,6 +1495,8 @@ Main::Main(CkMigrateMessage* m) : CBase_Main(m) {
     mainChare = thishandle;
     bIsRestarting = 1;
     bHaveAlpha = 1;
+    bSkinValid = 0;
+    nSkinSPH = 0;
     CkPrintf("Main(CkMigrateMessage) called\n");
     sorter = CProxy_Sorter::ckNew(0);
     }
@@ -1645,6 +1729,19 @@ inline void Main::waitForGravity(const CkCallback &cb, double startTime,
 #endif
     }
 
+/// @brief Whether the substeps need domain decomposition and a tree.
+///
+/// Without self gravity, gas, star formation, feedback, sinks or
+/// SIDM, particles only feel the external potential, so a substep
+/// is just kicks and drifts.  Such runs (e.g. orbit integrations in
+/// a static potential) skip the decomposition, load balancing and
+/// tree build.
+bool Main::substepNeedsTree()
+{
+    return param.bDoGravity || param.bDoGas || param.bStarForm
+        || param.bFeedback || param.sinks.bDoSinks || param.iSIDMSelect;
+}
+
 /// @brief Perform domain decomposition
 /// @param Active rung (or phase).
 
@@ -1765,6 +1862,14 @@ void Main::startGravity(const CkCallback& cbGravity, int iActiveRung,
 #ifdef CUDA
         if (nActiveGrav > param.nGpuMinParts) CkPrintf("Gravity will be calculated on the GPU\n");
 #endif
+        // Timestep criteria that only depend on gravity are evaluated
+        // as each bucket finishes; see TreePiece::adjust().  External
+        // gravity, sinks and SIDM change the accelerations afterwards.
+        int bEpsAccFinish = param.bEpsAccStep && !param.bDoExternalGravity
+            && !param.sinks.bDoSinks && !param.iSIDMSelect;
+        int bGravStepFinish = param.bGravStep && !param.bDoExternalGravity;
+        double aFinish = csmTime2Exp(param.csm,dTime);
+        double dAccFac = 1.0/(aFinish*aFinish*aFinish);
         CkPrintf("Calculating gravity (tree bucket, theta = %f) ... ", theta);
         *startTime = CkWallTimer();
         if(param.bConcurrentSph) {
@@ -1778,7 +1883,9 @@ void Main::startGravity(const CkCallback& cbGravity, int iActiveRung,
 #ifdef CUDA
                 bUseCpu = nActiveGrav < param.nGpuMinParts;
 #endif
-                treeProxy.startGravity(iActiveRung, bUseCpu, theta, cbGravity);
+                treeProxy.startGravity(iActiveRung, bUseCpu, theta,
+                                       bEpsAccFinish, bGravStepFinish,
+                                       param.dEta, dAccFac, cbGravity);
 
 #ifdef PUSH_GRAVITY
             }
@@ -1797,7 +1904,10 @@ void Main::startGravity(const CkCallback& cbGravity, int iActiveRung,
 #ifdef CUDA
                 bUseCpu = nActiveGrav < param.nGpuMinParts;
 #endif
-                treeProxy.startGravity(iActiveRung, bUseCpu, theta, CkCallbackResumeThread());
+                treeProxy.startGravity(iActiveRung, bUseCpu, theta,
+                                       bEpsAccFinish, bGravStepFinish,
+                                       param.dEta, dAccFac,
+                                       CkCallbackResumeThread());
 
 #ifdef PUSH_GRAVITY
             }
@@ -1952,6 +2062,11 @@ void Main::advanceBigStep(int iStep) {
   int currentStep = 0; // the current timestep within the big step
   int activeRung = 0;  // the minimum rung that is active
   int nextMaxRung = 0; // the rung that determines the smallest time for advancing
+  // Release of the node cache from the previous substep, which
+  // overlaps the timestep adjustment and opening kick.
+  CkCallback *cbCache = NULL;
+  int cacheRung = 0;
+  bool bNeedTree = substepNeedsTree();
 
   while (currentStep < MAXSUBSTEPS) {
 
@@ -1976,6 +2091,9 @@ void Main::advanceBigStep(int iStep) {
       // Opening Kick
       CkCallback cbNull(CkCallback::invalid); // Nothing to wait for
                                               // in opening Kick
+      // updateuDot() also reduces over the smoothProxy shadow array.
+      if(param.bDoGas)
+          waitForNodeCache(cbCache, cacheRung);
       kick(false, activeRung, nextMaxRung, cbNull, 0.0);
 
       if(verbosity > 1)
@@ -1995,6 +2113,8 @@ void Main::advanceBigStep(int iStep) {
 	  }
       
       double dTimeSub = RungToDt(param.dDelta, driftRung);
+      // The drift deletes the tree
+      waitForNodeCache(cbCache, cacheRung);
       // Drift of smallest step
       for(int iSub = 0; iSub < driftSteps; iSub++) 
 	  {
@@ -2010,7 +2130,7 @@ void Main::advanceBigStep(int iStep) {
 	      
 	      double dDriftFac = csmComoveDriftFac(param.csm, dTime, dTimeSub);
 	      double dKickFac = csmComoveKickFac(param.csm, dTime, dTimeSub);
-	      bool bBuildTree = (iSub + 1 == driftSteps);
+	      bool bBuildTree = (iSub + 1 == driftSteps) && bNeedTree;
 	      treeProxy.drift(dDriftFac, param.bDoGas, param.bGasIsothermal,
 			      dKickFac, dTimeSub, nGrowMassDrift, bBuildTree,
                               param.dMaxEnergy,
@@ -2043,6 +2163,8 @@ void Main::advanceBigStep(int iStep) {
           }
     }
 
+    waitForNodeCache(cbCache, cacheRung);
+
     // determine largest timestep that needs a kick
     activeRung = 0;
     int tmpRung = currentStep;
@@ -2063,16 +2185,6 @@ void Main::advanceBigStep(int iStep) {
         if(param.bFeedback) 
             StellarFeedback(dTime, param.stfm->dDeltaStarForm);
         }
-    if(param.sinks.bDoSinks) {
-	CkReductionMsg *msgCnt;
-	treeProxy.countType(TYPE_SINK,
-			    CkCallbackResumeThread((void *&)msgCnt));
-	nSink = *(int *) msgCnt->getData();
-	delete msgCnt;
-	if(nSink != 0)
-	    CkPrintf("Sink number of Sinks: nSink = %ld\n", nSink);
-	}
-
     ckout << "\nStep: " << (iStep + ((double) currentStep)/MAXSUBSTEPS)
           << " Time: " << dTime
           << " Rungs " << activeRung << " to "
@@ -2084,28 +2196,30 @@ void Main::advanceBigStep(int iStep) {
 	memoryStats();
 
     CkPrintf("Elapsed time: %g\n", CkWallTimer() - dSimStartTime);
-    /***** Resorting of particles and Domain Decomposition *****/
-    domainDecomp(activeRung);
-
-    if(verbosity > 1)
-	memoryStats();
-    CkPrintf("Elapsed time: %g\n", CkWallTimer() - dSimStartTime);
-    /********* Load balancer ********/
-    loadBalance(activeRung);
+    if(bNeedTree) {
+        /***** Resorting of particles and Domain Decomposition *****/
+        domainDecomp(activeRung);
 
-    if(verbosity > 1)
-	memoryStats();
+        if(verbosity > 1)
+	    memoryStats();
+        CkPrintf("Elapsed time: %g\n", CkWallTimer() - dSimStartTime);
+        /********* Load balancer ********/
+        loadBalance(activeRung);
 
-    CkPrintf("Elapsed time: %g\n", CkWallTimer() - dSimStartTime);
-    /******** Tree Build *******/
-    buildTree(activeRung);
+        if(verbosity > 1)
+	    memoryStats();
 
-    CkCallback cbGravity(CkCallback::resumeThread);
+        CkPrintf("Elapsed time: %g\n", CkWallTimer() - dSimStartTime);
+        /******** Tree Build *******/
+        buildTree(activeRung);
 
 #ifdef COOLING_MOLECULARH
-    // XXX should this go inside buildTree()?
-    treeProxy.distribLymanWerner(CkCallbackResumeThread());
+        // XXX should this go inside buildTree()?
+        treeProxy.distribLymanWerner(CkCallbackResumeThread());
 #endif /*COOLING_MOLECULARH*/
+        }
+
+    CkCallback cbGravity(CkCallback::resumeThread);
 
     if(verbosity > 1)
 	memoryStats();
@@ -2173,13 +2287,13 @@ void Main::advanceBigStep(int iStep) {
             }
         }
 
-    double startTime = CkWallTimer();
-    CkPrintf("Elapsed time: %g\n", startTime - dSimStartTime);
-    treeProxy.finishNodeCache(CkCallbackResumeThread());
-    double tCache = CkWallTimer() - startTime;
-    timings[activeRung].tCache += tCache;
-    if(verbosity)
-        CkPrintf("Finish NodeCache took %g seconds.\n", tCache);
+    CkPrintf("Elapsed time: %g\n", CkWallTimer() - dSimStartTime);
+    if(bNeedTree) {
+        // Waited for by waitForNodeCache() before the next drift.
+        cbCache = new CkCallback(CkCallback::resumeThread);
+        cacheRung = activeRung;
+        treeProxy.finishNodeCache(*cbCache);
+        }
 
 #ifdef CHECK_TIME_WITHIN_BIGSTEP
     if(param.iWallRunTime > 0 && ((CkWallTimer()-wallTimeStart) > param.iWallRunTime*60.)){
@@ -2189,6 +2303,25 @@ void Main::advanceBigStep(int iStep) {
 #endif
 
   }
+  waitForNodeCache(cbCache, cacheRung);
+}
+
+/// @brief Wait for a finishNodeCache() started by advanceBigStep().
+/// @param cbCache Callback given to finishNodeCache(); NULL if
+/// there is nothing to wait for.  It is deleted and set to NULL.
+/// @param activeRung Rung to which the wait is charged.
+void Main::waitForNodeCache(CkCallback *&cbCache, int activeRung)
+{
+    if(cbCache == NULL)
+        return;
+    double startTime = CkWallTimer();
+    CkFreeMsg(cbCache->thread_delay());
+    delete cbCache;
+    cbCache = NULL;
+    double tCache = CkWallTimer() - startTime;
+    timings[activeRung].tCache += tCache;
+    if(verbosity)
+        CkPrintf("Finish NodeCache took %g seconds.\n", tCache);
 }
     
 ///
@@ -2456,15 +2589,11 @@ void Main::setupICs() {
 #ifdef DTADJUST
   ofsLog << " DTADJUST";
 #endif
-#if WENDLAND == 1
-  ofsLog << " WENDLAND";
-#endif
-#if M4KERNEL == 1
-  ofsLog << " M4KERNEL";
-#endif
-#if M6KERNEL == 1
-  ofsLog << " M6KERNEL";
-#endif
+  // The kernel is selected at run time; log it under the names of
+  // the old compile time options.
+  const char *achSphKernel[SPH_KERNEL_N] = {"M4KERNEL", "M6KERNEL",
+      "WENDLANDC2", "WENDLAND", "WENDLANDC6"};
+  ofsLog << " " << achSphKernel[param.iSPHKernel];
 #ifdef SPLITGAS
   ofsLog << " SPLITGAS";
 #endif
@@ -2663,6 +2792,39 @@ Main::restart(CkCheckpointStatusMsg *msg)
 	prmAddParam(prm,"dFracLoadBalance",paramDouble,&param.dFracLoadBalance,
 		    sizeof(double), "fraclb",
 		    "Minimum active particles for load balancing");
+	prmAddParam(prm,"dLBLoadSmooth",paramDouble,&param.dLBLoadSmooth,
+		    sizeof(double), "lbsmooth",
+		    "Weight of latest measurement in smoothed per rung cost per active particle for load prediction (1 = no smoothing)");
+	prmAddParam(prm,"bLBIncremental",paramBool,&param.bLBIncremental,
+		    sizeof(int), "lbincr",
+		    "ORB balancers refine the previous assignment instead of repartitioning = -lbincr");
+	prmAddParam(prm,"dLBMaxMigrate",paramDouble,&param.dLBMaxMigrate,
+		    sizeof(double), "lbmaxmig",
+		    "Maximum MB of particles migrated per incremental load balance (<= 0: no limit)");
+	prmAddParam(prm,"dCommLBTolerance",paramDouble,&param.dCommLBTolerance,
+		    sizeof(double), "commlbtol",
+		    "Maximum load, relative to the average, of a processor receiving a TreePiece in MultistepCommLB");
+	prmAddParam(prm,"nCommLBPasses",paramInt,&param.nCommLBPasses,
+		    sizeof(int), "commlbpasses",
+		    "Number of communication refinement passes of MultistepCommLB");
+	prmAddParam(prm,"bSmoothReuse",paramBool,&param.bSmoothReuse,
+		    sizeof(int), "smoothreuse",
+		    "ReSmooth visits the buckets found by the preceding neighbor search instead of walking the tree = -smoothreuse");
+	prmAddParam(prm,"dSmoothSkin",paramDouble,&param.dSmoothSkin,
+		    sizeof(double), "smoothskin",
+		    "Skin, as a fraction of fBall, within which drifted gas reuses its last fBall to bound the density neighbor search (0 = off)");
+	prmAddParam(prm,"bSnapKeyBox",paramBool,&param.bSnapKeyBox,
+		    sizeof(int), "snapkeybox",
+		    "Snap the key bounding box to a power of two grid and assign keys during the drift while it stays valid = -snapkeybox");
+	prmAddParam(prm,"dSmoothPredict",paramDouble,&param.dSmoothPredict,
+		    sizeof(double), "smoothpredict",
+		    "Safety factor on fBall predicted from divv as the initial density neighbor search radius (0 = off)");
+	prmAddParam(prm,"iSPHKernel",paramInt,&param.iSPHKernel,
+		    sizeof(int), "sphkernel",
+		    "SPH kernel: 0 M4, 1 M6, 2 Wendland C2, 3 Wendland C4, 4 Wendland C6 (default from configure)");
+	prmAddParam(prm,"bSPHKernelTable",paramBool,&param.bSPHKernelTable,
+		    sizeof(int), "sphkerneltable",
+		    "Interpolate the SPH kernel from a table instead of evaluating it = -sphkerneltable");
 	prmAddParam(prm, "dFracNoDomainDecomp", paramDouble,
 		    &param.dFracNoDomainDecomp, sizeof(double),"fndd",
 		    "Fraction of active particles for no new DD = 0.0");
@@ -2673,6 +2835,11 @@ Main::restart(CkCheckpointStatusMsg *msg)
 	if(!prmArgProc(prm,CmiGetArgc(args->argv),args->argv,processSimfile)) {
 	    CkExit();
 	}
+	if(param.iSPHKernel < 0 || param.iSPHKernel >= SPH_KERNEL_N) {
+	    ckerr << "iSPHKernel must be from 0 to " << SPH_KERNEL_N - 1
+		  << endl;
+	    CkAbort("Bad value for iSPHKernel");
+	    }
 	
 	dMProxy.resetReadOnly(param, CkCallbackResumeThread());
         if (bUseCkLoopPar) {
@@ -3820,6 +3987,10 @@ void Main::countActive(int activeRung)
     ckout << "Gravity Active: " << nActive[0]
 	  << ", Gas Active: " << nActive[1] << endl ;
     
+    // nSink is kept up to date where sinks are made or merged.
+    if(param.sinks.bDoSinks && nSink != 0)
+	CkPrintf("Sink number of Sinks: nSink = %ld\n", nSink);
+
     delete msg;
     }
 
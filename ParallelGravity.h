@@ -9,6 +9,7 @@
 #include <map>
 #include <vector>
 #include <algorithm>
+#include <functional>
 
 #include "pup_stl.h"
 #include "ckio.h"
@@ -75,10 +76,15 @@ enum LBStrategy{
   Orb3d_notopo,
   MultistepOrb,
   Multistep_SFC,
-  HierarchOrb
+  HierarchOrb,
+  MultistepComm
 };
 PUPbytes(LBStrategy);
 
+/// Slots of the per TreePiece cache fill table used by
+/// MultistepCommLB; must be a power of 2.
+#define COMM_FILL_SLOTS 128
+
 #ifdef SELECTIVE_TRACING
 enum TraceState {
   TraceNormal = 0,
@@ -119,6 +125,7 @@ inline void operator|(PUP::er &p,DomainsDec &d) {
 }
 
 #include "GravityParticle.h"
+#include "ExtraDataPool.h"
 
 class SmoothParams;
 
@@ -150,6 +157,16 @@ extern DomainsDec domainDecomposition;
 extern double dExtraStore;
 extern double dMaxBalance;
 extern double dFracLoadBalance;
+extern double dLBLoadSmooth;
+extern int bLBIncremental;
+extern double dLBMaxMigrate;
+extern double dCommLBTolerance;
+extern int nCommLBPasses;
+extern int bSmoothReuse;
+extern double dSmoothSkin;
+extern int bSnapKeyBox;
+extern int iSphKernel;
+extern int bSphKernelTable;
 extern double dGlassDamper;
 extern int bUseCkLoopPar;
 extern GenericTrees useTree;
@@ -320,6 +337,15 @@ public:
       nloads(nload), n(npart), nSPH(nsph), nStar(nstar) {}
 };
 
+/// @brief Smooth cache writebacks for one TreePiece, merged over
+/// the buckets it sent.  See TreePiece::flushSmoothParticles().
+class SmoothFlushMsg : public CMessage_SmoothFlushMsg {
+public:
+    int nBuckets;       ///< Number of cache entries written back
+    int nBytes;
+    char *data;
+};
+
 #ifdef PUSH_GRAVITY
 #include "ckmulticast.h"
 
@@ -495,6 +521,11 @@ class Main : public CBase_Main {
 				   simulation early */
 	int64_t nActiveGrav;
 	int64_t nActiveSPH;
+	/// fBall of all gas was found since the skin drifts were reset,
+	/// and the gas has not changed since (dSmoothSkin).
+	int bSkinValid;
+	/// Number of gas particles when the skin drifts were reset
+	int64_t nSkinSPH;
 
 #ifdef CUDA
           double localNodesPerReqDouble;
@@ -563,7 +594,9 @@ public:
 	void restart(CkCheckpointStatusMsg *msg);
 	void waitForGravity(const CkCallback &cb, double startTime,
             int activeRung);
+	void waitForNodeCache(CkCallback *&cbCache, int activeRung);
         void advanceBigStep(int);
+        bool substepNeedsTree();
         void domainDecomp(int iPhase);
         void loadBalance(int iPhase);
         void buildTree(int iPhase);
@@ -691,6 +724,11 @@ typedef struct LoopParDataStruct {
   TreePiece* tp;                           ///< Treepiece that owns this data
 } LoopParData;
 
+/** @brief Work on the particles iStart to iEnd - 1 of a TreePiece as
+ * chunk iChunk of TreePiece::particleLoop().
+ */
+typedef std::function<void(int iChunk, int iStart, int iEnd)> ParticleLoopFn;
+
 
 
 #ifdef CUDA
@@ -741,6 +779,32 @@ struct NonLocalMomentsClientList {
   }
 };
 
+/// @brief A bucket visited by a k nearest neighbor smooth walk.  These
+/// are recorded per local bucket so that a following ReSmooth over the
+/// same balls can visit them directly instead of walking the tree.
+struct SmoothBucketRef {
+  /// Particles of a bucket on this PE, or NULL to request them from
+  /// the smooth particle cache.
+  GravityParticle *particles;
+  Tree::NodeKey key;
+  int remoteIndex;
+  int firstParticle;
+  int lastParticle;
+  int chunk;
+  /// Bucket and periodic replica as encoded in the walk
+  int reqID;
+  OrientedBox<cosmoType> boundingBox;
+};
+
+/// @brief Buckets recorded for one local bucket, and the particle type
+/// that was searched for.
+struct SmoothBucketRefList {
+  int iType;
+  std::vector<SmoothBucketRef> refs;
+
+  SmoothBucketRefList() : iType(0) {}
+};
+
 /// Fundamental structure that holds particle and tree data.
 class TreePiece : public CBase_TreePiece {
    // jetley
@@ -750,10 +814,12 @@ class TreePiece : public CBase_TreePiece {
    friend class KNearestSmoothCompute;
    friend class ReSmoothCompute;
    friend class MarkSmoothCompute;
+   friend class BallSmoothCompute;
    friend class ListCompute;
    friend class NearNeighborState;
    friend class ReNearNeighborState;
    friend class MarkNeighborState;
+   friend class BallNeighborState;
    friend class BottomUpTreeWalk;
 #if INTERLIST_VER > 0 && defined CUDA
    friend class DataManager;
@@ -780,6 +846,14 @@ class TreePiece : public CBase_TreePiece {
    State *sPrefetchState;
    /// Keeps track of the gravity walks over the local tree.
    State *sLocalGravityState, *sRemoteGravityState, *sSmoothState;
+   /// Buckets visited by the last k nearest neighbor walk of each
+   /// bucket (bSmoothReuse); cleared when the tree is rebuilt.
+   std::vector<SmoothBucketRefList> smoothBucketRefs;
+   /// Search radius of each particle in that walk, 0 if not searched.
+   std::vector<double> smoothRefBall;
+   /// Number of isSmoothActive() particles in each bucket for the
+   /// current smooth walk.
+   std::vector<int> smoothBucketActive;
    typedef std::map<KeyType, CkVec<int>* > SmPartRequestType;
    // buffer of requests for smoothParticles.
    SmPartRequestType smPartRequests;
@@ -1068,6 +1142,33 @@ private:
         int iPrevRungLB;
         /// The phase for which we are about to do load balancing
         int iActiveRungLB;
+        /// Estimated bytes fetched from remote TreePieces on cache
+        /// misses since the last load balancing (MultistepCommLB
+        /// only), in an open addressed table keyed by TreePiece
+        /// index.  Peers that find the table full are not recorded.
+        int commFillPeer[COMM_FILL_SLOTS];
+        float commFillBytes[COMM_FILL_SLOTS];
+        void recordCommFill(int remoteIndex, float bytes) {
+            if(foundLB != MultistepComm)
+                return;
+            for(int k = 0; k < COMM_FILL_SLOTS; k++) {
+                int iSlot = (remoteIndex + k) & (COMM_FILL_SLOTS - 1);
+                if(commFillPeer[iSlot] == remoteIndex) {
+                    commFillBytes[iSlot] += bytes;
+                    return;
+                    }
+                if(commFillPeer[iSlot] < 0) {
+                    commFillPeer[iSlot] = remoteIndex;
+                    commFillBytes[iSlot] = bytes;
+                    return;
+                    }
+                }
+        }
+        void clearCommFill() {
+            for(int k = 0; k < COMM_FILL_SLOTS; k++)
+                commFillPeer[k] = -1;
+        }
+        void setCommLBData();
 
 	/// @brief Used to inform the mainchare that the requested operation has
 	/// globally finished
@@ -1087,6 +1188,29 @@ private:
 	int nStore;
         /// Accelerations are initialized
         bool bBucketsInited;
+        /// Particle indices sorted by decreasing rung, so the
+        /// particles on a rung or above come first; see
+        /// rungOrderActive().
+        std::vector<int> rungOrder;
+        /// Number of entries of rungOrder on each rung or above
+        int nRungOrder[MAXRUNG+2];
+        /// rungOrder matches the particles and their rungs; every
+        /// change of the particles or their order must call
+        /// invalidateRungOrder().
+        bool bRungOrderValid;
+        /// Gravity timestep criteria of the particles that were
+        /// active in the last gravity calculation, evaluated by
+        /// finishBucket(); indexed like myParticles, negative for
+        /// inactive particles.
+        std::vector<double> dtGravFinish;
+        /// Rung dtGravFinish was calculated for, or -1 if it is not
+        /// valid.
+        int iGravFinishRung;
+        /// Criteria included in dtGravFinish; see adjust().
+        int bEpsAccFinish, bGravStepFinish;
+        /// Timestep factor and cosmological acceleration scaling
+        /// used for dtGravFinish.
+        double dEtaFinish, dAccFacFinish;
 
   // Temporary location to hold the particles that have come from outside this
   // TreePiece. This is used in the case where we migrate the particles and
@@ -1182,6 +1306,12 @@ private:
 	std::string basefilename;
 	// Bounding box of the entire simulation
 	OrientedBox<float> boundingBox;
+	/// Cubical box the particle keys were last generated in
+	OrientedBox<float> keyBox;
+	/// keyBox has been set by assignKeys()
+	bool bKeyBoxValid;
+	/// drift() already generated the keys in keyBox
+	bool bKeysProvisional;
 	unsigned iterationNo;
 	/// The root of the global tree, always local to any chare
 	GenericTreeNode* root;
@@ -1224,6 +1354,9 @@ private:
 	int bGasCooling;
 #ifndef COOLING_NONE
 	clDerivsData *CoolData;
+	/// Integrator contexts for the chunks after the first of a
+	/// particleLoop() in updateuDot()
+	std::vector<clDerivsData *> CoolDataChunks;
 #endif
         /// indices of my newly formed particles in the starlog table
         std::vector<int> iSeTab;
@@ -1408,7 +1541,13 @@ private:
 	void smoothNextBucket();
 	void reSmoothNextBucket();
 	void markSmoothNextBucket();
-	void smoothBucketComputation();
+	void ballSmoothNextBucket();
+	void smoothBucketComputation(int currentBucket);
+	bool smoothRefsUsable(int iBucket);
+	void smoothBucketReplay();
+	void recordSmoothBucket(int iBucket, const SmoothBucketRef &ref);
+	void startSmoothBucketRefs(int iBucket, int iType);
+	void setSmoothRefBall(int iPart, double h);
 	/** @brief Start the treewalk for the next bucket among those belonging
 	 * to me. The buckets are simply ordered in a vector.
 	 */
@@ -1492,6 +1631,11 @@ public:
 	  myNumParticles = myNumSPH = myNumStar = 0;
 	  nStore = nStoreSPH = nStoreStar = 0;
           bBucketsInited = false;
+          bRungOrderValid = false;
+          iGravFinishRung = -1;
+          clearCommFill();
+          bKeyBoxValid = false;
+          bKeysProvisional = false;
 	  myTreeParticles = -1;
 	  orbBoundaries.clear();
 	  boxes = NULL;
@@ -1544,6 +1688,11 @@ public:
 	  boxes = NULL;
 	  splitDims = NULL;
           bBucketsInited = false;
+          bRungOrderValid = false;
+          iGravFinishRung = -1;
+          clearCommFill();
+          bKeyBoxValid = false;
+          bKeysProvisional = false;
 	  myTreeParticles = -1;
 
 
@@ -1552,20 +1701,36 @@ public:
 
         private:
         void freeWalkObjects();
+	void allocateGas() {
+	    nStoreSPH = (int) (myNumSPH*(1.0 + dExtraStore));
+	    mySPHParticles = gasDataPool().take(nStoreSPH);
+	    }
 	void allocateStars() {
 	    nStoreStar = (int) (myNumStar*(1.0 + dExtraStore));
 	    // Stars tend to form out of gas, so make sure there is
 	    // enough room.
 	    nStoreStar += 12 + (int) (myNumSPH*dExtraStore);
-	    myStarParticles = new extraStarData[nStoreStar];
+	    myStarParticles = starDataPool().take(nStoreStar);
+	    }
+	/// Release the gas data to the pool
+	void freeGas() {
+	    gasDataPool().give(mySPHParticles, nStoreSPH);
+	    mySPHParticles = NULL;
+	    nStoreSPH = 0;
+	    }
+	/// Release the star data to the pool
+	void freeStars() {
+	    starDataPool().give(myStarParticles, nStoreStar);
+	    myStarParticles = NULL;
+	    nStoreStar = 0;
 	    }
 
         public:
 	~TreePiece() {
 	  if (verbosity>1) ckout <<"Deallocating treepiece "<<thisIndex<<endl;
 	  if(nStore > 0) delete[] myParticles;
-	  if(nStoreSPH > 0) delete[] mySPHParticles;
-	  if(nStoreStar > 0) delete[] myStarParticles;
+	  freeGas();
+	  freeStars();
 	  delete[] nodeInterRemote;
 	  delete[] particleInterRemote;
 	  delete[] bucketReqs;
@@ -1579,6 +1744,8 @@ public:
 #ifndef COOLING_NONE
 	  if(bGasCooling)
 	      CoolDerivsFinalize(CoolData);
+	  for(unsigned int i = 0; i < CoolDataChunks.size(); i++)
+	      CoolDerivsFinalize(CoolDataChunks[i]);
 #endif
           if (verbosity>1) ckout <<"Finished deallocation of treepiece "<<thisIndex<<endl;
 	}
@@ -1593,6 +1760,19 @@ public:
   void calculateEwaldUsingCkLoop(int yield_num);
   void callBucketEwald(int id);
   void doParallelNextBucketWork(int id, LoopParData* lpdata);
+  int particleLoopChunks(int nParticles);
+  void particleLoop(const ParticleLoopFn &fn, int nChunks);
+  void particleLoop(const ParticleLoopFn &fn, int nChunks, int iFirst,
+                    int nParticles);
+  int rungOrderActive(int iRung);
+  void sortRungOrder(int iRung);
+  /// @brief Note that particles were reordered or rungs changed, so
+  /// rungOrder must be rebuilt.  dtGravFinish is indexed like the
+  /// particles, so it is dropped as well.
+  void invalidateRungOrder() {
+      bRungOrderValid = false;
+      iGravFinishRung = -1;
+      }
 	void initCoolingData(const CkCallback& cb);
 	// Scale velocities (needed to convert to canonical momenta for
 	// comoving coordinates.)
@@ -1801,6 +1981,8 @@ public:
 			double dStartTime[MAXRUNG+1], int bCool, int bAll,
 			int bUpdateState, double gammam1, double dResolveJeans, const CkCallback& cb);
 	void ballMax(int activeRung, double dFac, const CkCallback& cb);
+	void getSkinDrift(const CkCallback& cb);
+	void resetSkinDrift(const CkCallback& cb);
 	void sphViscosityLimiter(int bOn, int activeRung, const CkCallback& cb);
     void getAdiabaticGasPressure(double gamma, double gammam1, double dTuFac, double dThermalCondCoeff,
         double dThermalCond2Coeff, double dThermalCondSatCoeff, double dThermalCond2SatCoeff,
@@ -1891,9 +2073,11 @@ public:
 	void calculateSmoothLocal();
 	void calculateReSmoothLocal();
 	void calculateMarkSmoothLocal();
+	void calculateBallSmoothLocal();
 	void nextBucketSmooth(dummyMsg *msg);
 	void nextBucketReSmooth(dummyMsg *msg);
 	void nextBucketMarkSmooth(dummyMsg *msg);
+	void nextBucketBallSmooth(dummyMsg *msg);
 #if INTERLIST_VER > 0
 #if 0
   void calculateForceRemoteBucket(int bucketIndex, int chunk);
@@ -1905,8 +2089,16 @@ public:
   /// @param am the active rung for the computation
   /// @param theta the opening angle
   /// @param bUseCpu_ whether the cpu or gpu is being used
+  /// @param bEpsAccStep evaluate the sqrt(eps/acc) timestep of
+  /// collisionless particles as buckets finish
+  /// @param bGravStep evaluate the sqrt(r^3/GM) timestep as buckets
+  /// finish
+  /// @param dEta Factor to use in determing timestep
+  /// @param dAccFac Acceleration scaling for cosmology
   /// @param cb the callback to use after all the computation has finished
-  void startGravity(int am, int bUseCpu_, double myTheta, const CkCallback& cb);
+  void startGravity(int am, int bUseCpu_, double myTheta,
+                    int bEpsAccStep, int bGravStep, double dEta,
+                    double dAccFac, const CkCallback& cb);
   /// Setup utility function for all the smooths.  Initializes caches.
   void setupSmooth();
   /// Start a tree based smooth computation.
@@ -1920,6 +2112,9 @@ public:
 		   double dfBall2OverSoft2, const CkCallback &cb);
   void startReSmooth(SmoothParams *p, const CkCallback& cb);
   void startMarkSmooth(SmoothParams *p, const CkCallback& cb);
+  /// Start a smooth over all neighbors within
+  /// SmoothParams::fBallQuery() of each active particle.
+  void startBallSmooth(SmoothParams *p, const CkCallback& cb);
 
   void finishNodeCache(const CkCallback& cb);
 
@@ -1944,6 +2139,9 @@ public:
 	/// @brief Check if we have done with the treewalk on a specific bucket,
 	/// and if we have, check also if we are done with all buckets
 	void finishBucket(int iBucket);
+	/// @brief Evaluate the gravity timestep criteria of the active
+	/// particles of a finished bucket into dtGravFinish.
+	void gravStepFinish(GenericTreeNode *bucket);
 
 	/** @brief Routine which does the tree walk on non-local nodes. It is
 	 * called back for every incoming node (which are those requested to the
@@ -1969,7 +2167,7 @@ public:
                                             int reqID, int awi, void *source);
 	void fillRequestParticles(CkCacheRequestMsg<KeyType> *msg);
 	void fillRequestSmoothParticles(CkCacheRequestMsg<KeyType> *msg);
-	void flushSmoothParticles(CkCacheFillMsg<KeyType> *msg);
+	void flushSmoothParticles(SmoothFlushMsg *msg);
 	void processReqSmoothParticles();
 
 	void getParticleInfoForLB(int64_t active_part, int64_t total_part);
@@ -713,12 +713,27 @@ Main::doSph(int activeRung, int bNeedDensity)
 {
   if(bNeedDensity) {
     double dfBall2OverSoft2 = 4.0*param.dhMinOverSoft*param.dhMinOverSoft;
+    // Bound the neighbor searches with the distance drifted since
+    // fBall was last found for all gas.
+    double dSkinDrift = -1.0;
+    if(dSmoothSkin > 0.0) {
+	dSkinDrift = HUGE_VAL;
+	if(bSkinValid && nSkinSPH == nTotalSPH) {
+	    CkReductionMsg *msg;
+	    treeProxy.getSkinDrift(CkCallbackResumeThread((void*&)msg));
+	    dSkinDrift = *(double *)msg->getData();
+	    delete msg;
+	    }
+	}
     if (param.bFastGas && nActiveSPH < nTotalSPH*param.dFracFastGas) {
 	ckout << "Calculating densities/divv on Actives ...";
 	// This also marks neighbors of actives
 	DenDvDxSmoothParams pDen(TYPE_GAS, activeRung, param.csm, dTime, 1,
 				 param.bConstantDiffusion, 0, 0,
                                  param.dConstAlphaMax);
+	pDen.dSkinDrift = dSkinDrift;
+	pDen.dBallPredict = param.dSmoothPredict;
+	pDen.dDeltaPredict = param.dDelta;
 	double startTime = CkWallTimer();
 	treeProxy.startSmooth(&pDen, 1, param.nSmooth, dfBall2OverSoft2,
 			      CkCallbackResumeThread());
@@ -739,6 +754,9 @@ Main::doSph(int activeRung, int bNeedDensity)
 	DenDvDxNeighborSmParams pDenN(TYPE_GAS, activeRung, param.csm, dTime,
 				      param.bConstantDiffusion,
                                       param.dConstAlphaMax);
+	pDenN.dSkinDrift = dSkinDrift;
+	pDenN.dBallPredict = param.dSmoothPredict;
+	pDenN.dDeltaPredict = param.dDelta;
 	startTime = CkWallTimer();
 	treeProxy.startSmooth(&pDenN, 1, param.nSmooth, dfBall2OverSoft2,
 			      CkCallbackResumeThread());
@@ -752,11 +770,20 @@ Main::doSph(int activeRung, int bNeedDensity)
 	DenDvDxSmoothParams pDen(TYPE_GAS, activeRung, param.csm, dTime, 0,
 				 param.bConstantDiffusion, 0, 0,
                                  param.dConstAlphaMax);
+	pDen.dSkinDrift = dSkinDrift;
+	pDen.dBallPredict = param.dSmoothPredict;
+	pDen.dDeltaPredict = param.dDelta;
 	double startTime = CkWallTimer();
 	treeProxy.startSmooth(&pDen, 1, param.nSmooth, dfBall2OverSoft2,
 			      CkCallbackResumeThread());
 	ckout << " took " << (CkWallTimer() - startTime) << " seconds."
 	      << endl;
+	if(dSmoothSkin > 0.0) {
+	    // All gas now has fSkinBall; start a new skin.
+	    treeProxy.resetSkinDrift(CkCallbackResumeThread());
+	    bSkinValid = 1;
+	    nSkinSPH = nTotalSPH;
+	    }
 
 	if(verbosity > 1 && !param.bConcurrentSph)
 	    memoryStatsCache();
@@ -868,6 +895,17 @@ void TreePiece::updateuDot(int activeRung,
 			   const CkCallback& cb)
 {
 #ifndef COOLING_NONE
+    int nActive = rungOrderActive(activeRung);
+    int nChunks = particleLoopChunks(nActive);
+    // Each chunk needs its own integrator context.
+    if(bCool) {
+        while(CoolDataChunks.size() < nChunks - 1)
+            CoolDataChunks.push_back(CoolDerivsInit(dm->Cool));
+        }
+
+    particleLoop([&](int iChunk, int iStart, int iEnd) {
+    clDerivsData *coolData = (iChunk == 0 ? CoolData
+                              : CoolDataChunks[iChunk - 1]);
     double dt; // time in seconds
     double fDensity;
     double E;
@@ -877,7 +915,8 @@ void TreePiece::updateuDot(int activeRung,
     double cGas;
     double ExternalHeating;
     
-    for(unsigned int i = 1; i <= myNumParticles; ++i) {
+    for(int k = iStart; k < iEnd; ++k) {
+	int i = rungOrder[k];
 	GravityParticle *p = &myParticles[i];
 	if (TYPETest(p, TYPE_GAS)
 	    && (p->rung == activeRung || (bAll && p->rung >= activeRung))) {
@@ -931,11 +970,11 @@ void TreePiece::updateuDot(int activeRung,
 #ifdef COOLDEBUG
                 dm->Cool->iOrder = p->iOrder; /*For debugging purposes */
 #endif
-                CoolIntegrateEnergyCode(dm->Cool, CoolData, &cp, &E,
+                CoolIntegrateEnergyCode(dm->Cool, coolData, &cp, &E,
                             ExternalHeating, fDensityHot,
                             p->fMetals(), r, dt, columnLHot);
 #else /*COOLING_MOLECULARH*/
-                CoolIntegrateEnergyCode(dm->Cool, CoolData, &cp, &E, ExternalHeating, fDensityHot,
+                CoolIntegrateEnergyCode(dm->Cool, coolData, &cp, &E, ExternalHeating, fDensityHot,
                         p->fMetals(), r, dt);
 #endif
                 p->uHotDot() = (E- p->uHot())/duDelta[p->rung];
@@ -988,11 +1027,11 @@ void TreePiece::updateuDot(int activeRung,
 #ifdef COOLDEBUG
 		dm->Cool->iOrder = p->iOrder; /*For debugging purposes */
 #endif
-		CoolIntegrateEnergyCode(dm->Cool, CoolData, &cp, &E,
+		CoolIntegrateEnergyCode(dm->Cool, coolData, &cp, &E,
 					ExternalHeating, fDensity,
 					p->fMetals(), r, dtUse, columnL);
 #else /*COOLING_MOLECULARH*/
-		CoolIntegrateEnergyCode(dm->Cool, CoolData, &cp, &E,
+		CoolIntegrateEnergyCode(dm->Cool, coolData, &cp, &E,
 					ExternalHeating, fDensity,
 					p->fMetals(), r, dtUse);
 #endif /*COOLING_MOLECULARH*/
@@ -1008,6 +1047,7 @@ void TreePiece::updateuDot(int activeRung,
             CkAssert(isfinite(p->uDot()));
 	    }
 	}
+    }, nChunks, 0, nActive);
 #endif
     // Use shadow array to avoid reduction conflict
     smoothProxy[thisIndex].ckLocal()->contribute(cb);
@@ -1024,6 +1064,33 @@ void TreePiece::ballMax(int activeRung, double dhFac, const CkCallback& cb)
     // Use shadow array to avoid reduction conflict
     smoothProxy[thisIndex].ckLocal()->contribute(cb);
     }
+
+/// @brief Contribute the largest distance drifted by a gas particle
+/// since the last resetSkinDrift().
+void TreePiece::getSkinDrift(const CkCallback& cb)
+{
+    double dMaxDrift = 0.0;
+    for(unsigned int i = 1; i <= myNumParticles; ++i) {
+	if (TYPETest(&myParticles[i], TYPE_GAS)
+	    && myParticles[i].fSkinDrift() > dMaxDrift)
+	    dMaxDrift = myParticles[i].fSkinDrift();
+	}
+    // Use shadow array to avoid reduction conflict
+    smoothProxy[thisIndex].ckLocal()->contribute(sizeof(double), &dMaxDrift,
+						 CkReduction::max_double, cb);
+    }
+
+/// @brief Start accumulating drifts for the smooth skin bound.  Called
+/// after fBall has been found for all gas.
+void TreePiece::resetSkinDrift(const CkCallback& cb)
+{
+    for(unsigned int i = 1; i <= myNumParticles; ++i) {
+	if (TYPETest(&myParticles[i], TYPE_GAS))
+	    myParticles[i].fSkinDrift() = 0.0;
+	}
+    // Use shadow array to avoid reduction conflict
+    smoothProxy[thisIndex].ckLocal()->contribute(cb);
+    }
     
 int DenDvDxSmoothParams::isSmoothActive(GravityParticle *p) 
 {
@@ -1123,28 +1190,43 @@ void DenDvDxSmoothParams::fcnSmooth(GravityParticle *p, int nSmooth,
 	grx = 0; gry = 0; grz= 0;
 
 	qiActive = 0;
-	for (i=0;i<nSmooth;++i) {
-		double fDist2 = nnList[i].fKey;
-		r2 = fDist2*ih2;
-		q = nnList[i].p;
-        CkMustAssert(!(q == NULL), "NULL neighbor in DenDvDxSmooth");
+	// Neighbors are processed in tiles: a gather loop does the
+	// marking and the accessor calls into SoA arrays, kernelList()
+	// has neither so it vectorizes, and the sums are taken in
+	// neighbor order so results do not depend on the tiling.
+	for (int iTile = 0; iTile < nSmooth; iTile += DENDVDX_TILE) {
+	    const int nTile = std::min(DENDVDX_TILE, nSmooth - iTile);
+	    double ar2[DENDVDX_TILE], aMass[DENDVDX_TILE], aU[DENDVDX_TILE];
+	    double aDvx[DENDVDX_TILE], aDvy[DENDVDX_TILE], aDvz[DENDVDX_TILE];
+	    double aRs[DENDVDX_TILE], aRs1[DENDVDX_TILE];
+	    for (i=0;i<nTile;++i) {
+		q = nnList[iTile+i].p;
+		CkMustAssert(!(q == NULL), "NULL neighbor in DenDvDxSmooth");
 		if (p->rung >= activeRung)
 		    TYPESet(q,TYPE_NbrOfACTIVE); /* important for SPH */
 		if(q->rung >= activeRung)
 		    qiActive = 1;
-		rs = KERNEL(r2, nSmooth);
-		fDensity += rs*q->mass;
+		ar2[i] = nnList[iTile+i].fKey*ih2;
+		aMass[i] = q->mass;
+		aU[i] = q->uPred();
+		aDvx[i] = (-p->vPred().x + q->vPred().x)*vFac;
+		aDvy[i] = (-p->vPred().y + q->vPred().y)*vFac;
+		aDvz[i] = (-p->vPred().z + q->vPred().z)*vFac;
+		}
+	    kernelList(ar2, aRs, aRs1, nTile, nSmooth);
+	    for (i=0;i<nTile;++i) {
+		rs = aRs[i];
+		fDensity += rs*aMass[i];
 #ifdef SUPERBUBBLE
-		fDensityU += rs*q->mass*q->uPred();
-#endif
-		rs1 = DKERNEL(r2);
-		rs1 *= q->mass;
-		dx = nnList[i].dx.x; /* NB: dx = px - qx */
-		dy = nnList[i].dx.y;
-		dz = nnList[i].dx.z;
-		dvx = (-p->vPred().x + q->vPred().x)*vFac;
-		dvy = (-p->vPred().y + q->vPred().y)*vFac;
-		dvz = (-p->vPred().z + q->vPred().z)*vFac;
+		fDensityU += rs*aMass[i]*aU[i];
+#endif
+		rs1 = aRs1[i]*aMass[i];
+		dx = nnList[iTile+i].dx.x; /* NB: dx = px - qx */
+		dy = nnList[iTile+i].dx.y;
+		dz = nnList[iTile+i].dx.z;
+		dvx = aDvx[i];
+		dvy = aDvy[i];
+		dvz = aDvz[i];
 		dvxdx += dvx*dx*rs1;
 		dvxdy += dvx*dy*rs1;
 		dvxdz += dvx*dz*rs1;
@@ -1159,20 +1241,23 @@ void DenDvDxSmoothParams::fcnSmooth(GravityParticle *p, int nSmooth,
 		/* This used to be:
                    grx += (-p->uPred + q->uPred)*dx*rs1; But that is
                    rho grad u*/
-                grx += (q->uPred())*dx*rs1;
-                gry += (q->uPred())*dy*rs1;
-                grz += (q->uPred())*dz*rs1;
+                grx += aU[i]*dx*rs1;
+                gry += aU[i]*dy*rs1;
+                grz += aU[i]*dz*rs1;
 #ifdef SUPERBUBBLE
-                rgux += (q->uPred()-p->uPred())*dx*rs1;
-                rguy += (q->uPred()-p->uPred())*dy*rs1;
-                rguz += (q->uPred()-p->uPred())*dz*rs1;
+                rgux += (aU[i]-p->uPred())*dx*rs1;
+                rguy += (aU[i]-p->uPred())*dy*rs1;
+                rguz += (aU[i]-p->uPred())*dz*rs1;
 #endif
 
 #ifdef CULLENALPHA
                 // Special weighting function to reduce noise in R
                 // calculation.  See discussion after eq. 29 in
                 // Wadsley et al 2017.
-                double R_wt = (1-r2*r2*0.0625)* q->mass;
+                double fDist2 = nnList[iTile+i].fKey;
+                q = nnList[iTile+i].p;
+                r2 = ar2[i];
+                double R_wt = (1-r2*r2*0.0625)* aMass[i];
                 R_CD += q->dvds_old() * R_wt; 
                 R_CDN += R_wt;
                 // Convention here dvdx = vxq-vxp, dx = xp-xq so
@@ -1182,9 +1267,9 @@ void DenDvDxSmoothParams::fcnSmooth(GravityParticle *p, int nSmooth,
                 double cavg = (p->c() + q->c())*0.5;
                 double vSig = cavg - (dvdotdr < 0 ? dvdotdr/sqrt(fDist2) : 0);
                 if (vSig > maxVSignal) maxVSignal = vSig; 
-
 #endif
 		}
+	    }
 
         if (qiActive)
           TYPESet(p,TYPE_NbrOfACTIVE);
@@ -1557,6 +1642,30 @@ void PressureSmoothParams::combSmoothCache(GravityParticle *p1,
 #endif
 	}
 
+/// Fields read by PressureSmoothParams::combSmoothCache()
+static const SmoothCacheField aPressureCacheFields[] = {
+    SMOOTH_CACHE_FIELD(PdV),
+    SMOOTH_CACHE_FIELD(uDotPdV),
+    SMOOTH_CACHE_FIELD(uDotDiff),
+    SMOOTH_CACHE_FIELD(uDotAV),
+    SMOOTH_CACHE_FIELD(mumax),
+    SMOOTH_CACHE_FIELD(treeAcceleration),
+#ifdef DIFFUSION
+    SMOOTH_CACHE_FIELD(fMetalsDot),
+    SMOOTH_CACHE_FIELD(fMFracOxygenDot),
+    SMOOTH_CACHE_FIELD(fMFracIronDot),
+#endif
+#ifdef DTADJUST
+    SMOOTH_CACHE_FIELD(dtNew),
+#endif
+};
+
+const SmoothCacheField *PressureSmoothParams::smoothCacheFields(int &nFields)
+{
+    nFields = sizeof(aPressureCacheFields)/sizeof(aPressureCacheFields[0]);
+    return aPressureCacheFields;
+    }
+
 void PressureSmoothParams::fcnSmooth(GravityParticle *p, int nSmooth,
                     pqSmoothNode *nnList)
 {
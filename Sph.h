@@ -10,6 +10,9 @@
 
 #endif
 
+/// Number of neighbors gathered at a time in DenDvDxSmoothParams::fcnSmooth()
+#define DENDVDX_TILE 64
+
 /// @brief Parameters and functions for the first SPH smooth: density
 /// and velocity derivatives.
 class DenDvDxSmoothParams : public SmoothParams
@@ -166,6 +169,7 @@ class PressureSmoothParams : public SmoothParams
     virtual void initSmoothCache(GravityParticle *p);
     virtual void combSmoothCache(GravityParticle *p1,
 				 ExternalSmoothParticle *p2);
+    virtual const SmoothCacheField *smoothCacheFields(int &nFields);
  public:
     PressureSmoothParams() {}
     /// @param _iType Type of particles to smooth
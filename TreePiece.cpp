@@ -3,6 +3,7 @@
 
 #include <cstdio>
 #include <algorithm>
+#include <functional>
 #include <fstream>
 #include <assert.h>
 #include <float.h>
@@ -20,6 +21,7 @@
 #include "Orb3dLB.h"
 #include "Orb3dLB_notopo.h"
 #include "HierarchOrbLB.h"
+#include "MultistepCommLB.h"
 // jetley - refactoring
 //#include "codes.h"
 #include "Opt.h"
@@ -57,6 +59,25 @@ extern CkGroupID ckMulticastGrpId;
 
 CkpvExtern(int, _lb_obj_index);
 
+/// Released gas and star data arrays on this processor
+CpvStaticDeclare(ExtraDataPool<extraSPHData> *, gasPool);
+CpvStaticDeclare(ExtraDataPool<extraStarData> *, starPool);
+
+void initExtraDataPools() {
+    CpvInitialize(ExtraDataPool<extraSPHData> *, gasPool);
+    CpvInitialize(ExtraDataPool<extraStarData> *, starPool);
+    CpvAccess(gasPool) = new ExtraDataPool<extraSPHData>;
+    CpvAccess(starPool) = new ExtraDataPool<extraStarData>;
+}
+
+ExtraDataPool<extraSPHData> &gasDataPool() {
+    return *CpvAccess(gasPool);
+}
+
+ExtraDataPool<extraStarData> &starDataPool() {
+    return *CpvAccess(starPool);
+}
+
 //forward declaration
 string getColor(GenericTreeNode*);
 
@@ -117,6 +138,31 @@ void TreePiece::velScale(double dScale, const CkCallback& cb)
     contribute(cb);
     }
 
+/// @brief Cube in which to generate the keys of particles in box.
+///
+/// The half size is rounded up to a power of two, at least 1.25
+/// times that of the smallest enclosing cube, and the center is
+/// rounded to 1/16 of the half size.  The cube is therefore the same
+/// for small changes of the box, and it holds the box with room to
+/// spare so the keys fall between 0 and 1.  Used with bSnapKeyBox.
+static OrientedBox<float> snapKeyBox(const OrientedBox<float> &box)
+{
+    Vector3D<float> bsize = box.size();
+    double dHalf = 0.5*std::max(bsize.x, std::max(bsize.y, bsize.z));
+    int iExp;
+    frexp(1.25*dHalf, &iExp);
+    double dHalfKey = ldexp(1.0, iExp);  // >= 1.25*dHalf
+    double dQuantum = dHalfKey/16;
+    Vector3D<float> bcenter = box.center();
+    Vector3D<float> lesser, greater;
+    for(int j = 0; j < 3; j++) {
+        double dCenter = floor(bcenter[j]/dQuantum + 0.5)*dQuantum;
+        lesser[j] = dCenter - dHalfKey;
+        greater[j] = dCenter + dHalfKey;
+        }
+    return OrientedBox<float>(lesser, greater);
+}
+
 /// After the bounding box has been found, we can assign keys to the particles
 void TreePiece::assignKeys(CkReductionMsg* m) {
 	if(m->getSize() != sizeof(OrientedBox<float>)) {
@@ -135,19 +181,39 @@ void TreePiece::assignKeys(CkReductionMsg* m) {
 	//give particles keys, using bounding box to scale
 	if((domainDecomposition!=ORB_dec)
             && (domainDecomposition!=ORB_space_dec)){
-	      // get longest axis
-	      Vector3D<float> bsize = boundingBox.size();
-	      float max = (bsize.x > bsize.y) ? bsize.x : bsize.y;
-	      max = (max > bsize.z) ? max : bsize.z;
-	      //
-	      // Make the bounding box cubical.
-	      //
-	      Vector3D<float> bcenter = boundingBox.center();
-              // The magic number below is approximately 2^(-19)
-              const float fEps = 1.0 + 1.91e-6;  // slop to ensure keys fall
-                                                 // between 0 and 1.
-	      bsize = Vector3D<float>(fEps*0.5*max);
-	      boundingBox = OrientedBox<float>(bcenter-bsize, bcenter+bsize);
+              bool bSameBox = false;
+              if(bSnapKeyBox) {
+                  // Keep the previous key box while it still holds all
+                  // the particles and is not much too large; drift() has
+                  // then already generated the keys in it.
+                  bSameBox = bKeyBoxValid;
+                  Vector3D<float> bsize = boundingBox.size();
+                  Vector3D<float> ksize = keyBox.size();
+                  for(int j = 0; j < 3; j++)
+                      bSameBox = bSameBox
+                          && keyBox.lesser_corner[j] < boundingBox.lesser_corner[j]
+                          && boundingBox.greater_corner[j] < keyBox.greater_corner[j]
+                          && ksize[j] < 8.0*std::max(bsize.x, std::max(bsize.y, bsize.z));
+                  if(!bSameBox)
+                      keyBox = snapKeyBox(boundingBox);
+                  boundingBox = keyBox;
+                  bKeyBoxValid = true;
+                  }
+              else {
+                  // get longest axis
+                  Vector3D<float> bsize = boundingBox.size();
+                  float max = (bsize.x > bsize.y) ? bsize.x : bsize.y;
+                  max = (max > bsize.z) ? max : bsize.z;
+                  //
+                  // Make the bounding box cubical.
+                  //
+                  Vector3D<float> bcenter = boundingBox.center();
+                  // The magic number below is approximately 2^(-19)
+                  const float fEps = 1.0 + 1.91e-6;  // slop to ensure keys fall
+                                                     // between 0 and 1.
+                  bsize = Vector3D<float>(fEps*0.5*max);
+                  boundingBox = OrientedBox<float>(bcenter-bsize, bcenter+bsize);
+                  }
 	      if(thisIndex == 0 && verbosity > 1)
 		      ckout << "TreePiece: Bounding box now: "
 			   << boundingBox << endl;
@@ -155,13 +221,17 @@ void TreePiece::assignKeys(CkReductionMsg* m) {
               if(myNumParticles > 0) {
                   myParticles[0].key = firstPossibleKey;
                   myParticles[myNumParticles+1].key = lastPossibleKey;
-                  for(unsigned int i = 0; i < myNumParticles; ++i) {
-                    myParticles[i+1].key = generateKey(myParticles[i+1].position,
-                                                       boundingBox);
+                  if(!(bKeysProvisional && bSameBox)) {
+                      for(unsigned int i = 0; i < myNumParticles; ++i) {
+                          myParticles[i+1].key = generateKey(myParticles[i+1].position,
+                                                             boundingBox);
+                      }
                   }
                   sort(&myParticles[1], &myParticles[myNumParticles+1]);
+                  invalidateRungOrder();
               }
 	}
+	bKeysProvisional = false;
 
 #if COSMO_DEBUG > 1
   auto file_name = make_formatted_string("tree.%d.%d.before",thisIndex,iterationNo);
@@ -327,18 +397,19 @@ void TreePiece::sendORBParticles(){
     delete [] myParticles;
     nStore = (int)((myExpectedCount + 2)*(1.0 + dExtraStore));
     myParticles = new GravityParticle[nStore];
+    invalidateRungOrder();
   }
   myNumParticles = myExpectedCount;
 
   if(myExpectedCountSPH > (int) myNumSPH){
-    if(nStoreSPH > 0) delete [] mySPHParticles;
-    nStoreSPH = (int)(myExpectedCountSPH*(1.0 + dExtraStore));
-    mySPHParticles = new extraSPHData[nStoreSPH];
+    freeGas();
+    myNumSPH = myExpectedCountSPH;
+    allocateGas();
   }
   myNumSPH = myExpectedCountSPH;
 
   if(myExpectedCountStar > (int) myNumStar){
-    delete [] myStarParticles;
+    freeStars();
     allocateStars();
   }
   myNumStar = myExpectedCountStar;
@@ -388,6 +459,7 @@ void TreePiece::acceptORBParticles(const GravityParticle* particles,
 	else
 	    myParticles[i+1].extraData = NULL;
 	}
+    invalidateRungOrder();
 	  //signify completion with a reduction
     if(verbosity>1)
       ckout << thisIndex <<" contributing to accept particles"<<endl;
@@ -483,6 +555,7 @@ void TreePiece::evaluateParticleCounts(ORBSplittersMsg *splittersMsg)
     int dimen = (int)splittersMsg->dim[i];
     if(firstTime){
       sort(*iter,*iter2,compFuncPtr[dimen]);
+      invalidateRungOrder();
     }
     //Evaluate the number of particles in each division
 
@@ -812,6 +885,7 @@ void TreePiece::shuffleAfterQD() {
 
   nStore = (int)((dm->particleCounts[myPlace] + 2)*(1.0 + dExtraStore));
   myParticles = new GravityParticle[nStore];
+  invalidateRungOrder();
   myNumParticles = dm->particleCounts[myPlace];
   incomingParticlesArrived = 0;
   incomingParticlesSelf = false;
@@ -858,9 +932,7 @@ void TreePiece::mergeAllParticlesAndSaveCentroid() {
   }
 
   myNumSPH = nSPH;
-  nStoreSPH = (int)(myNumSPH*(1.0 + dExtraStore));
-  if(nStoreSPH > 0) mySPHParticles = new extraSPHData[nStoreSPH];
-  else mySPHParticles = NULL;
+  allocateGas();
 
   myNumStar = nStar;
   allocateStars();
@@ -1160,18 +1232,10 @@ void TreePiece::sendParticlesDuringDD(bool withqd) {
   myParticles = NULL;
   myNumParticles = 0;
   nStore = 0;
-  if (nStoreSPH > 0){
-      delete[] mySPHParticles;
-      mySPHParticles = NULL;
-  }
+  freeGas();
   myNumSPH = 0;
-  nStoreSPH = 0;
-  if (nStoreStar > 0){
-      delete[] myStarParticles;
-      myStarParticles = NULL;
-  }
+  freeStars();
   myNumStar = 0;
-  nStoreStar = 0;
 }
 
 /// Accept particles from other TreePieces once the sorting has finished
@@ -1220,6 +1284,7 @@ void TreePiece::acceptSortedParticles(ParticleShuffleMsg *shuffleMsg) {
 
     nStore = (int)((dm->particleCounts[myPlace] + 2)*(1.0 + dExtraStore));
     myParticles = new GravityParticle[nStore];
+    invalidateRungOrder();
     myNumParticles = dm->particleCounts[myPlace];
     incomingParticlesArrived = 0;
     incomingParticlesSelf = false;
@@ -1237,9 +1302,7 @@ void TreePiece::acceptSortedParticles(ParticleShuffleMsg *shuffleMsg) {
       nStar += incomingParticlesMsg[iMsg]->nStar;
     }
     myNumSPH = nSPH;
-    nStoreSPH = (int)(myNumSPH*(1.0 + dExtraStore));
-    if(nStoreSPH > 0) mySPHParticles = new extraSPHData[nStoreSPH];
-    else mySPHParticles = NULL;
+    allocateGas();
 
     myNumStar = nStar;
     allocateStars();
@@ -1282,6 +1345,7 @@ void TreePiece::acceptSortedParticles(ParticleShuffleMsg *shuffleMsg) {
     }
 
     sort(myParticles+1, myParticles+myNumParticles+1);
+    invalidateRungOrder();
     savedCentroid = vCenter/(double)myNumParticles;
     //signify completion with a reduction
     if(verbosity>1) ckout << thisIndex <<" contributing to accept particles"
@@ -1335,6 +1399,16 @@ void TreePiece::populateSavedPhaseData(int phase, double tp_load,
     }
     len = savedPhaseLoad.size();
   }
+  // Exponentially smooth the cost per active particle.  The load is
+  // stored as cost times particles so that it can be divided among
+  // TreePieces during the domain decomposition.
+  if (havePhaseData(phase) && savedPhaseParticle[phase] > 0
+      && activeparts > 0) {
+      double dCostOld = savedPhaseLoad[phase]/savedPhaseParticle[phase];
+      double dCostNew = tp_load/activeparts;
+      tp_load = activeparts*(dLBLoadSmooth*dCostNew
+                             + (1.0 - dLBLoadSmooth)*dCostOld);
+  }
   savedPhaseLoad[phase] = tp_load;
   savedPhaseParticle[phase] = activeparts;
 }
@@ -1446,8 +1520,11 @@ void TreePiece::kick(int iKickRung, double dDelta[MAXRUNG+1],
              double dEvapCoeff, //Thermal evaporation coefficient
 		     const CkCallback& cb) {
   // LBTurnInstrumentOff();
-  for(unsigned int i = 1; i <= myNumParticles; ++i) {
-      GravityParticle *p = &myParticles[i];
+  int nActive = rungOrderActive(iKickRung);
+  // Particles are independent: spread them over the node.
+  particleLoop([&](int iChunk, int iStart, int iEnd) {
+  for(int k = iStart; k < iEnd; ++k) {
+      GravityParticle *p = &myParticles[rungOrder[k]];
       if(p->rung >= iKickRung) {
 	  if(bNeedVPred && TYPETest(p, TYPE_GAS)) {
 	      if(bClosing) { // update predicted quantities to end of step
@@ -1654,18 +1731,20 @@ void TreePiece::kick(int iKickRung, double dDelta[MAXRUNG+1],
 	  glassDamping(p->velocity, dDelta[p->rung], dGlassDamper);
 	  }
       }
+  }, particleLoopChunks(nActive), 0, nActive);
   contribute(cb);
 }
 
 void TreePiece::initAccel(int iKickRung, const CkCallback& cb) 
 {
-    for(unsigned int i = 1; i <= myNumParticles; ++i) {
-	if(myParticles[i].rung >= iKickRung) {
-	    myParticles[i].treeAcceleration = 0;
-	    myParticles[i].potential = 0;
-	    myParticles[i].dtGrav = 0;
-	    }
+    int nActive = rungOrderActive(iKickRung);
+    for(int k = 0; k < nActive; ++k) {
+	GravityParticle *p = &myParticles[rungOrder[k]];
+	p->treeAcceleration = 0;
+	p->potential = 0;
+	p->dtGrav = 0;
 	}
+    iGravFinishRung = -1;
 
     bBucketsInited = true;
     contribute(cb);
@@ -1701,6 +1780,11 @@ void TreePiece::distribLymanWerner(const CkCallback& cb)
  * @param dResolveJeans multiple of Jeans length to be resolved.
  * @param bDoGas We are calculating gas forces.
  * @param cb Callback function reduces currrent maximum rung
+ *
+ * The gravity criteria of particles that were active in the last
+ * gravity calculation are usually already in dtGravFinish; only the
+ * remaining criteria are evaluated here.  Every active particle is
+ * still visited.
  */
 void TreePiece::adjust(int iKickRung, int bEpsAccStep, int bGravStep,
 		       int bSphStep, int bViscosityLimitdt,
@@ -1711,16 +1795,38 @@ void TreePiece::adjust(int iKickRung, int bEpsAccStep, int bGravStep,
                        double dResolveJeans,
 		       int bDoGas,
 		       const CkCallback& cb) {
+  int nActive = rungOrderActive(iKickRung);
+  int nChunks = particleLoopChunks(nActive);
+  // Maximum rungs found by each chunk; combined below.
+  std::vector<int> chunkMaxRung(nChunks), chunkNMaxRung(nChunks);
+  std::vector<int> chunkMaxRungGas(nChunks);
+  // Use the gravity criteria already evaluated by finishBucket()
+  // if they are for these particles and parameters.
+  bool bFinish = iGravFinishRung == iKickRung
+      && dtGravFinish.size() == myNumParticles + 2
+      && (bEpsAccStep || !bEpsAccFinish) && (bGravStep || !bGravStepFinish)
+      && dEtaFinish == dEta && dAccFacFinish == dAccFac;
+  iGravFinishRung = -1;
+
+  particleLoop([&](int iChunk, int iStart, int iEnd) {
   int iCurrMaxRung = 0;
   int nMaxRung = 0;  // number of particles in maximum rung
   int iCurrMaxRungGas = 0;
   
-  for(unsigned int i = 1; i <= myNumParticles; ++i) {
+  for(int k = iStart; k < iEnd; ++k) {
+    int i = rungOrder[k];
     GravityParticle *p = &myParticles[i];
     if(p->rung >= iKickRung) {
       double dTIdeal = dDelta;
       double dTGrav, dTCourant, dTEdot;
-      if(bEpsAccStep) {
+      bool bEpsAccDone = false, bGravStepDone = false;
+      if(bFinish && dtGravFinish[i] >= 0.0) {
+          bEpsAccDone = bEpsAccFinish && !p->isGas();
+          bGravStepDone = bGravStepFinish;
+          if(dtGravFinish[i] < dTIdeal)
+              dTIdeal = dtGravFinish[i];
+          }
+      if(bEpsAccStep && !bEpsAccDone) {
          CkMustAssert(p->soft > 0, "Cannot use bEpsAccStep with zero softening length particle\n");
 	  double acc = dAccFac*p->treeAcceleration.length();
 	  double dt;
@@ -1745,7 +1851,7 @@ void TreePiece::adjust(int iKickRung, int bEpsAccStep, int bGravStep,
 	  if(dt < dTIdeal)
 	      dTIdeal = dt;
 	  }
-      if(bGravStep) {
+      if(bGravStep && !bGravStepDone) {
 	  double dt = dEta/sqrt(dAccFac*p->dtGrav);
 	  if(dt < dTIdeal)
 	      dTIdeal = dt;
@@ -1853,6 +1959,26 @@ void TreePiece::adjust(int iKickRung, int bEpsAccStep, int bGravStep,
 #endif
     }
   }
+  chunkMaxRung[iChunk] = iCurrMaxRung;
+  chunkNMaxRung[iChunk] = nMaxRung;
+  chunkMaxRungGas[iChunk] = iCurrMaxRungGas;
+  }, nChunks, 0, nActive);
+  // Only active particles moved, and they stay at iKickRung or above.
+  sortRungOrder(iKickRung);
+
+  int iCurrMaxRung = 0;
+  int nMaxRung = 0;  // number of particles in maximum rung
+  int iCurrMaxRungGas = 0;
+  for(int iChunk = 0; iChunk < nChunks; iChunk++) {
+      if(chunkMaxRung[iChunk] > iCurrMaxRung) {
+          iCurrMaxRung = chunkMaxRung[iChunk];
+          nMaxRung = chunkNMaxRung[iChunk];
+          }
+      else if(chunkMaxRung[iChunk] == iCurrMaxRung)
+          nMaxRung += chunkNMaxRung[iChunk];
+      if(chunkMaxRungGas[iChunk] > iCurrMaxRungGas)
+          iCurrMaxRungGas = chunkMaxRungGas[iChunk];
+      }
   // Pack into array for reduction
   int64_t newcount[3];
   newcount[0] = iCurrMaxRung;
@@ -1861,6 +1987,52 @@ void TreePiece::adjust(int iKickRung, int bEpsAccStep, int bGravStep,
   contribute(3*sizeof(int64_t), newcount, max_count, cb);
 }
 
+/// @brief Counting sort of rungOrder by decreasing rung.
+/// @param iRung Only sort the leading entries that were on rung iRung
+/// or above; the particles behind them must not have changed rung.
+/// Use 0 to rebuild rungOrder from all particles.
+void TreePiece::sortRungOrder(int iRung) {
+    if(!bRungOrderValid || rungOrder.size() != myNumParticles)
+        iRung = 0;
+    int nSort;
+    if(iRung == 0) {
+        rungOrder.resize(myNumParticles);
+        for(unsigned int i = 1; i <= myNumParticles; ++i)
+            rungOrder[i-1] = i;
+        nSort = myNumParticles;
+        }
+    else
+        nSort = nRungOrder[iRung];
+
+    int nInRung[MAXRUNG+1];
+    for(int r = 0; r <= MAXRUNG; r++) nInRung[r] = 0;
+    for(int k = 0; k < nSort; k++) {
+        CkAssert(myParticles[rungOrder[k]].rung >= iRung);
+        nInRung[myParticles[rungOrder[k]].rung]++;
+        }
+    int iOffset[MAXRUNG+1];
+    nRungOrder[MAXRUNG+1] = 0;
+    for(int r = MAXRUNG; r >= iRung; r--) {
+        iOffset[r] = nRungOrder[r+1];
+        nRungOrder[r] = nRungOrder[r+1] + nInRung[r];
+        }
+    std::vector<int> sorted(nSort);
+    for(int k = 0; k < nSort; k++)
+        sorted[iOffset[myParticles[rungOrder[k]].rung]++] = rungOrder[k];
+    std::copy(sorted.begin(), sorted.end(), rungOrder.begin());
+
+    bRungOrderValid = true;
+    }
+
+/// @brief Number of particles on rung iRung or above.  Their indices
+/// are the first entries of rungOrder, which is rebuilt here if the
+/// particles have been reordered or their rungs changed.
+int TreePiece::rungOrderActive(int iRung) {
+    if(!bRungOrderValid || rungOrder.size() != myNumParticles)
+        sortRungOrder(0);
+    return nRungOrder[iRung];
+    }
+
 void TreePiece::truncateRung(int iCurrMaxRung, const CkCallback& cb) {
     for(unsigned int i = 1; i <= myNumParticles; ++i) {
 	GravityParticle *p = &myParticles[i];
@@ -1868,6 +2040,7 @@ void TreePiece::truncateRung(int iCurrMaxRung, const CkCallback& cb) {
 	    p->rung--;
 	CkAssert(p->rung <= iCurrMaxRung);
 	}
+    invalidateRungOrder();
     contribute(cb);
     }
 
@@ -1884,13 +2057,11 @@ void TreePiece::rungStats(const CkCallback& cb) {
 void TreePiece::countActive(int activeRung, const CkCallback& cb) {
   int64_t nActive[2];
 
-  nActive[0] = nActive[1] = 0;
-  for(unsigned int i = 1; i <= myNumParticles; ++i) {
-      if(myParticles[i].rung >= activeRung) {
-	  nActive[0]++;
-	  if(TYPETest(&myParticles[i], TYPE_GAS)) {
-	      nActive[1]++;
-	      }
+  nActive[0] = rungOrderActive(activeRung);
+  nActive[1] = 0;
+  for(int k = 0; k < nActive[0]; ++k) {
+      if(TYPETest(&myParticles[rungOrder[k]], TYPE_GAS)) {
+	  nActive[1]++;
 	  }
       }
   contribute(2*sizeof(int64_t), nActive, CkReduction::sum_long, cb);
@@ -1949,6 +2120,8 @@ void TreePiece::emergencyAdjust(int iRung, double dDelta, double dDeltaThresh,
 #endif
             }
         }
+    if(nUn > 0)
+        invalidateRungOrder();
     contribute(sizeof(nUn), &nUn, CkReduction::sum_int, cb);
 #else
     CkAbort("emergency adjust called without DTADJUST defined");
@@ -1986,12 +2159,27 @@ void TreePiece::drift(double dDelta,  // time step in x containing
   }
 
   boundingBox.reset();
+  // Generate the keys in the current key box here rather than in
+  // another pass over the particles in assignKeys().  They are kept
+  // unless a particle has left the box.  Only with bSnapKeyBox, since
+  // otherwise the box follows the particles every step.
+  bKeysProvisional = bSnapKeyBox && buildTree && bKeyBoxValid
+      && domainDecomposition != ORB_dec
+      && domainDecomposition != ORB_space_dec;
+  int nChunks = particleLoopChunks(myNumParticles);
+  // Bounding box of each chunk; combined below.
+  std::vector<OrientedBox<float> > chunkBox(nChunks);
+  std::vector<int> chunkInBox(nChunks, 1);
+
+  particleLoop([&](int iChunk, int iStart, int iEnd) {
   int bInBox = 1;
-
-  for(unsigned int i = 1; i <= myNumParticles; ++i) {
+  for(int i = iStart; i < iEnd; ++i) {
       GravityParticle *p = &myParticles[i];
-      if (p->iOrder >= nGrowMass)
+      if (p->iOrder >= nGrowMass) {
 	  p->position += dDelta*p->velocity;
+	  if(dSmoothSkin > 0.0 && TYPETest(p, TYPE_GAS))
+	      p->fSkinDrift() += fabs(dDelta)*p->velocity.length();
+	  }
       if(bPeriodic) {
         for(int j = 0; j < 3; j++) {
           if(p->position[j] >= 0.5*fPeriod[j]){
@@ -2013,7 +2201,9 @@ void TreePiece::drift(double dDelta,  // time step in x containing
           CkAbort("binbox failed\n");
         }
       }
-      boundingBox.grow(p->position);
+      chunkBox[iChunk].grow(p->position);
+      if(bKeysProvisional)
+          p->key = generateKey(p->position, keyBox);
       if(bNeedVpred && TYPETest(p, TYPE_GAS)) {
 	  p->vPred() += dvDelta*p->treeAcceleration;
 	  glassDamping(p->vPred(), dvDelta, dGlassDamper);
@@ -2069,6 +2259,14 @@ void TreePiece::drift(double dDelta,  // time step in x containing
 #endif /* DIFFUSION */
 	  }
       }
+  chunkInBox[iChunk] = bInBox;
+  }, nChunks);
+
+  int bInBox = 1;
+  for(int iChunk = 0; iChunk < nChunks; iChunk++) {
+      boundingBox.grow(chunkBox[iChunk]);
+      bInBox = bInBox && chunkInBox[iChunk];
+      }
   CkMustAssert(bInBox, "binbox2 failed\n");
   if(buildTree)
     contribute(sizeof(OrientedBox<float>), &boundingBox,
@@ -2118,6 +2316,7 @@ void TreePiece::newParticle(GravityParticle *p)
     // Move Boundary particle
     myParticles[myNumParticles+2] = myParticles[myNumParticles+1];
     myNumParticles++;
+    invalidateRungOrder();
     myParticles[myNumParticles] = *p;
     myParticles[myNumParticles].iOrder = -1;
     if(p->isGas()) {
@@ -2126,7 +2325,7 @@ void TreePiece::newParticle(GravityParticle *p)
             CkError("WARNING: Increasing gas particle store to %d\n",
                     nTmpStore);
             CkAssert(nTmpStore > nStoreSPH);
-            extraSPHData *myTmpParticles = new extraSPHData[nTmpStore];
+            extraSPHData *myTmpParticles = gasDataPool().take(nTmpStore);
             memcpy(myTmpParticles, mySPHParticles,
                    (myNumSPH)*sizeof(extraSPHData));
             for(int i = 1; i <= myNumParticles; i++) {
@@ -2137,7 +2336,7 @@ void TreePiece::newParticle(GravityParticle *p)
                     myParticles[i].extraData = myTmpParticles + iSPH;
                     }
                 }
-            delete[] mySPHParticles;
+            gasDataPool().give(mySPHParticles, nStoreSPH);
             mySPHParticles = myTmpParticles;
             nStoreSPH = nTmpStore;
             }
@@ -2151,7 +2350,7 @@ void TreePiece::newParticle(GravityParticle *p)
             CkError("WARNING: Increasing star particle store to %d\n",
                     nTmpStore);
             CkAssert(nTmpStore > nStoreStar);
-            extraStarData *myTmpParticles = new extraStarData[nTmpStore];
+            extraStarData *myTmpParticles = starDataPool().take(nTmpStore);
             memcpy(myTmpParticles, myStarParticles,
                    (myNumStar)*sizeof(extraStarData));
             for(int i = 1; i <= myNumParticles; i++) {
@@ -2162,7 +2361,7 @@ void TreePiece::newParticle(GravityParticle *p)
                     myParticles[i].extraData = myTmpParticles + iStar;
                     }
                 }
-            delete[] myStarParticles;
+            starDataPool().give(myStarParticles, nStoreStar);
             myStarParticles = myTmpParticles;
             nStoreStar = nTmpStore;
             }
@@ -2225,6 +2424,7 @@ void TreePiece::colNParts(const CkCallback &cb)
 	myParticles[j] = myParticles[i];
 
     myNumParticles = newNPart;
+    invalidateRungOrder();
     contribute(sizeof(counts), &counts, CkReduction::concat, cb);
     }
 
@@ -2565,6 +2765,9 @@ void TreePiece::buildTree(int bucketSize, const CkCallback& cb)
   maxBucketSize = bucketSize;
   callback = cb;
   myTreeParticles = myNumParticles;
+  // Recorded smooth buckets refer to the old tree
+  smoothBucketRefs.clear();
+  smoothRefBall.clear();
 
   deleteTree();
   if(bucketReqs != NULL) {
@@ -3734,6 +3937,8 @@ void TreePiece::finishBucket(int iBucket) {
 
   // XXX finished means Ewald is done.
   if(req->finished && remaining == 0) {
+    if(iGravFinishRung >= 0)
+      gravStepFinish(bucketList[iBucket]);
     sLocalGravityState->myNumParticlesPending -= 1;
 
 #ifdef COSMO_PRINT_BK
@@ -3773,6 +3978,36 @@ void TreePiece::finishBucket(int iBucket) {
   }
 }
 
+/// The accelerations of the bucket particles are final here and
+/// the particles were just written by the walk, so the timestep
+/// criteria that only depend on gravity are cheap to evaluate now.
+/// This saves adjust() their square roots, not its pass over the
+/// particles.  Gas is left to adjust(), since the SPH forces are
+/// added to its acceleration later.  The values are only used if
+/// nothing reorders the particles before adjust(); see
+/// invalidateRungOrder().
+void TreePiece::gravStepFinish(GenericTreeNode *bucket) {
+  for(int i = bucket->firstParticle; i <= bucket->lastParticle; ++i) {
+    GravityParticle *p = &myParticles[i];
+    if(p->rung < activeRung)
+      continue;
+    double dTIdeal = FLT_MAX;
+    if(bEpsAccFinish && !p->isGas()) {
+      CkMustAssert(p->soft > 0, "Cannot use bEpsAccStep with zero softening length particle\n");
+      double acc = dAccFacFinish*p->treeAcceleration.length();
+      double dt = dEtaFinish*sqrt(p->soft/acc);
+      if(dt < dTIdeal)
+        dTIdeal = dt;
+      }
+    if(bGravStepFinish) {
+      double dt = dEtaFinish/sqrt(dAccFacFinish*p->dtGrav);
+      if(dt < dTIdeal)
+        dTIdeal = dt;
+      }
+    dtGravFinish[i] = dTIdeal;
+  }
+}
+
 #ifdef CUDA
 /// @brief Fill GPU buffer with particle data
 /// @param bufLocalParts GPU buffer for particles
@@ -3914,6 +4149,7 @@ void TreePiece::nextBucket(dummyMsg *msg){
   unsigned int i=0;
 
   int currentBucket = sLocalGravityState->currentBucket;
+  int firstBucket = currentBucket;
   if(verbosity >= 4)
 	CkPrintf("[%d] walking bucket %d\n", thisIndex, currentBucket);	
 
@@ -4050,6 +4286,7 @@ void TreePiece::nextBucket(dummyMsg *msg){
     delete lpdata;
   }
 #endif
+  nodeLBMgrProxy.ckLocalBranch()->workDone(currentBucket - firstBucket);
 
   if (currentBucket<numBuckets) {
     thisProxy[thisIndex].nextBucket(msg);
@@ -4166,11 +4403,19 @@ void TreePiece::calculateEwald(EwaldMsg *msg) {
 
 }
 
+/// @brief Should this piece share its buckets with the other PEs of the
+/// node through CkLoop?  This is the case if more than half of them are
+/// idle, or if any of them is idle and this PE has the most gravity
+/// work left on the node.
 bool TreePiece::otherIdlePesAvail() {
-  vector<int> idlepes = nodeLBMgrProxy.ckLocalBranch()->getOtherIdlePes();
+  IntraNodeLBManager *nodeLBMgr = nodeLBMgrProxy.ckLocalBranch();
+  vector<int> idlepes = nodeLBMgr->getOtherIdlePes();
   if (idlepes.size() > 0.5 * CkMyNodeSize()) {
     return true;
   }
+  if (idlepes.size() > 0 && nodeLBMgr->isMostLoadedPe()) {
+    return true;
+  }
   return false;
 }
 
@@ -4235,6 +4480,85 @@ void TreePiece::calculateEwaldUsingCkLoop(int yield_num) {
   delete lpdata;
 }
 
+/// Fewest particles in a chunk of particleLoop() worth handing to
+/// another PE.
+const int PARTICLE_LOOP_MIN_CHUNK = 1024;
+
+/// @brief Number of chunks particleLoop() should split nParticles
+/// particles of this piece into.  This is 1 unless CkLoop is enabled
+/// and there are enough particles to be worth sharing with the other
+/// PEs of the node.
+int TreePiece::particleLoopChunks(int nParticles) {
+  if (!bUseCkLoopPar || CkMyNodeSize() < 2)
+    return 1;
+  int num_chunks = 2 * CkMyNodeSize();
+  // CkLoop library limits the number of chunks to be 64.
+  if (num_chunks > 64) {
+    num_chunks = 64;
+  }
+  if (num_chunks > nParticles/PARTICLE_LOOP_MIN_CHUNK) {
+    num_chunks = nParticles/PARTICLE_LOOP_MIN_CHUNK;
+  }
+  return (num_chunks > 1 ? num_chunks : 1);
+}
+
+/// Data passed to the PEs running a particleLoop()
+struct ParticleLoopData {
+  const ParticleLoopFn *fn;
+  int nChunks;
+  int iFirst;
+  int nParticles;
+};
+
+static void doParticleLoop(int start, int end, void *result, int pnum,
+                           void *param) {
+  ParticleLoopData *pldata = (ParticleLoopData *)param;
+  for (int iChunk = start; iChunk <= end; iChunk++) {
+    int iStart = pldata->iFirst
+        + (int64_t) iChunk*pldata->nParticles/pldata->nChunks;
+    int iEnd = pldata->iFirst
+        + (int64_t) (iChunk+1)*pldata->nParticles/pldata->nChunks;
+    (*pldata->fn)(iChunk, iStart, iEnd);
+  }
+}
+
+/// @brief Apply fn to the particles of this piece split into nChunks
+/// contiguous ranges.  With more than one chunk the ranges are run in
+/// parallel on the PEs of the node through CkLoop, so fn must only
+/// write to its own particles and to per chunk storage.
+/// @param fn Called with each chunk index and particle range.
+/// @param nChunks Number of chunks, usually from particleLoopChunks().
+void TreePiece::particleLoop(const ParticleLoopFn &fn, int nChunks) {
+  particleLoop(fn, nChunks, 1, myNumParticles);
+}
+
+/// @brief As above, but over the indices iFirst to iFirst +
+/// nParticles - 1.  These need not be particle indices, e.g. they can
+/// be positions in rungOrder.
+void TreePiece::particleLoop(const ParticleLoopFn &fn, int nChunks,
+                             int iFirst, int nParticles) {
+  if (nChunks <= 1) {
+    fn(0, iFirst, iFirst + nParticles);
+    return;
+  }
+  ParticleLoopData pldata;
+  pldata.fn = &fn;
+  pldata.nChunks = nChunks;
+  pldata.iFirst = iFirst;
+  pldata.nParticles = nParticles;
+
+  double timebeforeckloop = getObjTime();
+  LBTurnInstrumentOff();
+  double stime = CkWallTimer();
+#if CMK_SMP
+  CkLoop_Parallelize(doParticleLoop, 1, &pldata, nChunks, 0, nChunks-1);
+#else
+  CkAbort("CkLoop usage only in SMP mode\n");
+#endif
+  setObjTime(timebeforeckloop + CkWallTimer() - stime);
+  LBTurnInstrumentOn();
+}
+
 const char *typeString(NodeType type);
 
 void TreePiece::calculateGravityRemote(ComputeChunkMsg *msg) {
@@ -4255,6 +4579,7 @@ void TreePiece::calculateGravityRemote(ComputeChunkMsg *msg) {
 
   bool useckloop = false;
   int yield_num = _yieldPeriod;
+  int firstBucket = sRemoteGravityState->currentBucket;
 
 #if INTERLIST_VER > 0
 #if !defined(CUDA)
@@ -4460,6 +4785,8 @@ void TreePiece::calculateGravityRemote(ComputeChunkMsg *msg) {
     delete lpdata;
   }
 #endif
+  nodeLBMgrProxy.ckLocalBranch()->workDone(
+      sRemoteGravityState->currentBucket - firstBucket);
 
   if (sRemoteGravityState->currentBucket < numBuckets) {
     thisProxy[thisIndex].calculateGravityRemote(msg);
@@ -4721,7 +5048,9 @@ void TreePiece::finishNodeCache(const CkCallback& cb)
     for (j = 0; j < numChunks; j++) {
 	cacheNode.ckLocalBranch()->finishedChunk(j, 0);
     }
-    contribute(cb);
+    // Use shadow array to avoid reduction conflict: advanceBigStep()
+    // overlaps this with the adjust and kick reductions.
+    smoothProxy[thisIndex].ckLocal()->contribute(cb);
     }
 
 #ifdef PUSH_GRAVITY
@@ -4740,6 +5069,7 @@ void TreePiece::startPushGravity(int am, double myTheta){
   activeRung = am;
   theta = myTheta;
   thetaMono = theta*theta*theta*theta;
+  iGravFinishRung = -1;
 
   CkAssert(!doMerge);
   if(!createdSpanningTree){
@@ -4953,6 +5283,8 @@ void TreePiece::recvTotalMass(CkReductionMsg *msg){
 void TreePiece::startGravity(int am, // the active mask for multistepping
                                int bUseCpu_, // whether the cpu or gpu will be used
 			       double myTheta, // opening criterion
+                               int bEpsAccStep, int bGravStep,
+                               double dEta, double dAccFac,
 			       const CkCallback& cb) {
   bUseCpu = bUseCpu_;
 
@@ -4965,6 +5297,18 @@ void TreePiece::startGravity(int am, // the active mask for multistepping
   theta = myTheta;
   thetaMono = theta*theta*theta*theta;
 
+  // GPU results arrive after the buckets finish.
+  if((bEpsAccStep || bGravStep) && bUseCpu) {
+      iGravFinishRung = activeRung;
+      bEpsAccFinish = bEpsAccStep;
+      bGravStepFinish = bGravStep;
+      dEtaFinish = dEta;
+      dAccFacFinish = dAccFac;
+      dtGravFinish.assign(myNumParticles + 2, -1.0);
+      }
+  else
+      iGravFinishRung = -1;
+
   starttime = CmiWallTimer();
 
   int oldNumChunks = numChunks;
@@ -4978,7 +5322,8 @@ void TreePiece::startGravity(int am, // the active mask for multistepping
   cacheNode.ckLocalBranch()->cacheSync(numChunks, idxMax, localIndex);
   cacheGravPart.ckLocalBranch()->cacheSync(numChunks, idxMax, dummy);
 
-  nodeLBMgrProxy.ckLocalBranch()->registerTP();
+  // Each bucket is walked once locally and once per remote chunk
+  nodeLBMgrProxy.ckLocalBranch()->registerTP(numBuckets*(numChunks+1));
 
   if (myNumParticles == 0) {
     // No particles assigned to this TreePiece
@@ -5393,10 +5738,18 @@ void TreePiece::continueStartRemoteChunk(int chunk){
 
 /// @brief Sets the load of the TreePiece object based on the rung
 /// @param activeRung Rung to use.
+///
+/// The load is predicted from the smoothed cost per active particle
+/// of this rung (see populateSavedPhaseData()) times the number of
+/// particles now active on it, so changes in rung occupancy are
+/// reflected immediately.
 void TreePiece::setTreePieceLoad(int activeRung) {
     double dLoadExp;
     nPrevActiveParts = numActiveParticles;
-    if (havePhaseData(activeRung)) {
+    if (havePhaseData(activeRung) && savedPhaseParticle[activeRung] > 0) {
+        dLoadExp = savedPhaseLoad[activeRung]
+            *numActiveParticles/(double) savedPhaseParticle[activeRung];
+    } else if (havePhaseData(activeRung)) {
         dLoadExp = savedPhaseLoad[activeRung];
     } else if (havePhaseData(0)) {
         float ratio = 1.0;
@@ -5474,10 +5827,34 @@ void TreePiece::getParticleInfoForLB(int64_t active_part, int64_t total_part) {
           *(TaggedVector3D *) data = tv;
           }
       }
+  if (foundLB == MultistepComm)
+      setCommLBData();
   thisProxy[thisIndex].doAtSync();
   iPrevRungLB = iActiveRungLB;
 }
 
+/// @brief Pass the TreePieces we fetched the most data from to
+/// MultistepCommLB, and start a new accumulation.
+void TreePiece::setCommLBData() {
+  if (CkpvAccess(_lb_comm_obj_index) == -1)
+      return;
+  std::vector<std::pair<float, int> > peers;
+  for (int k = 0; k < COMM_FILL_SLOTS; k++)
+      if (commFillPeer[k] >= 0)
+          peers.push_back(std::make_pair(commFillBytes[k], commFillPeer[k]));
+  int nPeers = std::min((int) peers.size(), LB_COMM_MAX_PEERS);
+  std::partial_sort(peers.begin(), peers.begin() + nPeers, peers.end(),
+                    std::greater<std::pair<float, int> >());
+
+  TPCommData *data = (TPCommData *) getObjUserData(CkpvAccess(_lb_comm_obj_index));
+  data->nPeers = nPeers;
+  for (int i = 0; i < nPeers; i++) {
+      data->peer[i] = peers[i].second;
+      data->bytes[i] = peers[i].first;
+      }
+  clearCommFill();
+}
+
 void TreePiece::doAtSync(){
   if(verbosity > 1)
       CkPrintf("[%d] TreePiece %d calling AtSync() at %g\n",CkMyPe(),thisIndex, CkWallTimer());
@@ -5518,7 +5895,13 @@ GenericTreeNode* TreePiece::requestNode(int remoteIndex, Tree::NodeKey key,
 
     CkCacheRequestorData<KeyType> request(thisElement, &EntryTypeGravityNode::callback, userData);
     CkArrayIndexMax remIdx = CkArrayIndex1D(remoteIndex);
+    int nFills = gravityNodeEntry.nRequests;
     GenericTreeNode *res = (GenericTreeNode *) cacheNode.ckLocalBranch()->requestData(key,remIdx,chunk,&gravityNodeEntry,request);
+    // Only count misses that sent a request; a fill brings in a
+    // subtree _cacheLineDepth deep
+    if(gravityNodeEntry.nRequests != nFills)
+      recordCommFill(remoteIndex,
+                     ((2 << _cacheLineDepth) - 1)*sizeof(Tree::BinaryTreeNode));
 
 #ifdef CHANGA_REFACTOR_INTERLIST_PRINT_BUCKET_START_FIN
     if(source && !res){
@@ -5555,7 +5938,11 @@ ExternalGravityParticle *TreePiece::requestParticles(Tree::NodeKey key,int chunk
     // Key is shifted to distiguish between nodes and particles
     //
     KeyType ckey = key<<1;
+    int nFills = gravityParticleEntry.nRequests;
     CacheParticle *p = (CacheParticle *) cacheGravPart.ckLocalBranch()->requestData(ckey,remIdx,chunk,&gravityParticleEntry,request);
+    if (gravityParticleEntry.nRequests != nFills)
+      recordCommFill(remoteIndex,
+                     (end - begin + 1)*sizeof(ExternalGravityParticle));
     if (p == NULL) {
 #ifdef CHANGA_REFACTOR_INTERLIST_PRINT_BUCKET_START_FIN
       if(source){
@@ -5598,7 +5985,11 @@ TreePiece::requestSmoothParticles(Tree::NodeKey key,int chunk,int remoteIndex,
     CkCacheRequestorData<KeyType> request(thisElement, &EntryTypeSmoothParticle::callback, userData);
     CkArrayIndexMax remIdx = CkArrayIndex1D(remoteIndex);
     KeyType ckey = key<<1;
+    int nFills = smoothParticleEntry.nRequests;
     CacheSmoothParticle *p = (CacheSmoothParticle *) cacheSmoothPart.ckLocalBranch()->requestData(ckey,remIdx,chunk,&smoothParticleEntry,request);
+    if (smoothParticleEntry.nRequests != nFills)
+      recordCommFill(remoteIndex,
+                     (end - begin + 1)*sizeof(ExternalSmoothParticle));
     if (p == NULL) {
       return NULL;
     }
@@ -5744,8 +6135,8 @@ void TreePiece::pup(PUP::er& p) {
   if(p.isUnpacking()) {
       nStore = (int)((myNumParticles + 2)*(1.0 + dExtraStore));
       myParticles = new GravityParticle[nStore];
-      nStoreSPH = (int)(myNumSPH*(1.0 + dExtraStore));
-      if(nStoreSPH > 0) mySPHParticles = new extraSPHData[nStoreSPH];
+      invalidateRungOrder();
+      allocateGas();
       allocateStars();
   }
   for(unsigned int i=1;i<=myNumParticles;i++){
@@ -5788,6 +6179,9 @@ void TreePiece::pup(PUP::er& p) {
   }
   p | basefilename;
   p | boundingBox;
+  // All TreePieces must generate keys in the same box.
+  p | keyBox;
+  p | bKeyBoxValid;
   p | iterationNo;
 
   p | nSetupWriteStage;
@@ -6532,6 +6926,7 @@ void TreePiece::balanceBeforeInitialForces(const CkCallback &cb){
   string orb3d_notoponame("Orb3dLB_notopo");
   string msorb_name("MultistepOrbLB");
   string hierarch_name("HierarchOrbLB");
+  string mscomm_name("MultistepCommLB");
 
   BaseLB **lbs = lbMgr->getLoadBalancers();
   int i;
@@ -6566,6 +6961,9 @@ void TreePiece::balanceBeforeInitialForces(const CkCallback &cb){
         break;
       } else if(hierarch_name == string(lbs[i]->lbName())) {
         foundLB = HierarchOrb;
+      } else if(mscomm_name == string(lbs[i]->lbName())) {
+        foundLB = MultistepComm;
+        break;
       }
     }
   }
@@ -6577,6 +6975,8 @@ void TreePiece::balanceBeforeInitialForces(const CkCallback &cb){
           *(TaggedVector3D *)data = tv;
           }
       }
+  if (foundLB == MultistepComm)
+      setCommLBData();
   thisProxy[thisIndex].doAtSync();
 
   // this will be called in resumeFromSync()
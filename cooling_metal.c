@@ -46,10 +46,12 @@
 
 #ifdef USETABLE
 #define CLRATES( _cl, _Rate, _T, _rho)                clRates_Table( _cl, _Rate, _T, _rho)
+#define CLRATESMEMO( _cl, _Rate, _T, _rho, _Memo)     clRates_TableMemo( _cl, _Rate, _T, _rho, _Memo)
 #define CLEDOTINSTANT( _cl, _Y, _Rate, _rho, _ZMetal, _Heat, _Cool ) clEdotInstant_Table( _cl, _Y, _Rate, _rho, _ZMetal, _Heat, _Cool)
 
 #else
 #define CLRATES( _cl, _Rate, _T, _rho)   clRates( _cl, _Rate, _T, _rho)
+#define CLRATESMEMO( _cl, _Rate, _T, _rho, _Memo) clRatesMemo( _cl, _Rate, _T, _rho, _Memo)
 #define CLEDOTINSTANT( _cl, _Y, _Rate, _rho, _ZMetal, _Heat, _Cool ) clEdotInstant( _cl, _Y, _Rate, _rho, _ZMetal, _Heat, _Cool)
 
 #endif
@@ -100,6 +102,8 @@ COOL *CoolInit( )
   cl->RT = NULL;
   cl->MetalCoolln = NULL; 
   cl->MetalHeatln = NULL; 
+  cl->MetalCoolHeatz = NULL;
+  cl->iRatesGen = 0;
 
   cl->nTableRead = 0; /* Internal Tables read from Files */
 
@@ -119,6 +123,7 @@ clDerivsData *CoolDerivsInit(COOL *cl)
     assert(Data != NULL);
     Data->IntegratorContext = StiffInit(EPSINTEG, 4, Data, clDerivs);
     Data->cl = cl;
+    Data->Memo.iGen = -1;
 
     return Data;
     }
@@ -129,6 +134,7 @@ void CoolFinalize(COOL *cl )
   if (cl->RT != NULL) free(cl->RT);
   if (cl->MetalCoolln != NULL) free(cl->MetalCoolln); 
   if (cl->MetalHeatln != NULL) free (cl->MetalHeatln); 
+  if (cl->MetalCoolHeatz != NULL) free(cl->MetalCoolHeatz);
   free(cl);
 }
 
@@ -360,6 +366,8 @@ void clReadMetalTable(COOL *cl, COOLPARAM clParam)
   }
  
   fclose(fp);
+  cl->MetalCoolHeatz = (double *)malloc(nnH*nt*2*sizeof(double));
+  assert(cl->MetalCoolHeatz != NULL);
   return;  
 }
 
@@ -575,6 +583,39 @@ void clRatesTableError( COOL *cl ) {
 #define CL_Ccomp  (CL_Ccomp0*CL_Tcmb0)
 
 
+/*
+ * Interpolate the metal cooling and heating tables to the current
+ * redshift so that clRateMetalTable() only has to interpolate in
+ * density and temperature.  The interpolation is the one
+ * clRateMetalTable() used to do for each call.
+ */
+static void clMetalTableRedshift( COOL *cl ) {
+  double tempz, xz, wz0, wz1;
+  double *p;
+  int iz, j, k;
+
+  if (cl->MetalCoolHeatz == NULL) return;
+
+  tempz = cl->z;
+  if (cl->z <= cl->MetalzMin) tempz = cl->MetalzMin+EPS;
+  /* if redshift is too high or no UV, use the no UV metal cooling table*/
+  if (cl->z > cl->MetalzMax || !cl->bUV) tempz = cl->MetalzMax;
+
+  xz = cl->nzMetalTable -1 - (tempz - cl->MetalzMin)*cl->rDeltaz;
+  iz = xz;
+  xz = xz - iz;
+  wz1 = xz;
+  wz0 = 1-xz;
+
+  p = cl->MetalCoolHeatz;
+  for (j=0; j<cl->nnHMetalTable; j++) {
+    for (k=0; k<cl->nTMetalTable; k++, p+=2) {
+      p[0] = wz0*cl->MetalCoolln[iz][j][k] + wz1*cl->MetalCoolln[iz+1][j][k];
+      p[1] = wz0*cl->MetalHeatln[iz][j][k] + wz1*cl->MetalHeatln[iz+1][j][k];
+    }
+  }
+}
+
 void clRatesRedshift( COOL *cl, double zIn, double dTimeIn ) {
   int i;
   double xx;
@@ -593,6 +634,9 @@ void clRatesRedshift( COOL *cl, double zIn, double dTimeIn ) {
   clSetAbundanceTotals(cl,0.0,&Y_H,&Y_He,&Y_eMax); /* Hack to estimate Y_H */
   cl->R.Cool_LowTFactor = (cl->bLowTCool ? CL_B_gm*Y_H*Y_H/0.001 : 0 );
 
+  clMetalTableRedshift( cl );
+  cl->iRatesGen++;
+
   /* Photo-Ionization rates */
 
   UV = cl->UV;
@@ -697,25 +741,28 @@ double AP_Gamma_HeII_factor[] = { 0.97990208047216765, 0.98606251822654412,
 			0.035905775349044489, 0.0045537756654992923, 0.00035933897136804514,
 			1.2294426136470751e-6, 0.0, 0.0, 0.0, 0.0, 0.0 };
 
-void clRates( COOL *cl, RATE *Rate, double T, double rho ) {
-  double Tln;
-
-  if (T >= cl->TMax) T=cl->TMax*(1.0 - EPS);   
-  if (T < cl->TMin) T=cl->TMin;
-  Tln = log(T); /* Deprecated but log's, sqrt's etc... used in raw rate functions */
-
-  Rate->T = T;
-  Rate->Tln = Tln; 
-  Rate->Coll_HI = clRateCollHI( T );
-  Rate->Coll_HeI = clRateCollHeI( T );
-  Rate->Coll_HeII = clRateCollHeII( T );
+/*
+ * Memo of the rates that depend only on density.  The memo is
+ * forgotten when clRatesRedshift() changes the UV background.
+ */
+static RATEMEMO *clRateMemoCheck( COOL *cl, RATEMEMO *Memo ) {
+  if (Memo != NULL && Memo->iGen != cl->iRatesGen) {
+    Memo->iGen = cl->iRatesGen;
+    Memo->rho = -1;
+    Memo->nH = -1;
+  }
+  return Memo;
+}
 
-  Rate->Radr_HII = clRateRadrHII( T );
-  Rate->Radr_HeII = clRateRadrHeII( T );
-  Rate->Diel_HeII = clRateDielHeII( T );
-  Rate->Chtr_HeII = clRateChtrHeII( T );  
-  Rate->Totr_HeII = Rate->Radr_HeII + Rate->Diel_HeII + Rate->Chtr_HeII;
-  Rate->Radr_HeIII = clRateRadrHeIII( T );
+/* Photoionization rates, reduced by self shielding */
+static void clRatesPhot( COOL *cl, RATE *Rate, double rho, RATEMEMO *Memo ) {
+  Memo = clRateMemoCheck( cl, Memo );
+  if (Memo != NULL && Memo->rho == rho) {
+    Rate->Phot_HI = Memo->Phot_HI;
+    Rate->Phot_HeI = Memo->Phot_HeI;
+    Rate->Phot_HeII = Memo->Phot_HeII;
+    return;
+  }
 
   Rate->Phot_HI = cl->R.Rate_Phot_HI;
   Rate->Phot_HeI = cl->R.Rate_Phot_HeI;
@@ -739,6 +786,42 @@ void clRates( COOL *cl, RATE *Rate, double T, double rho ) {
 	  Rate->Phot_HeII *= (AP_Gamma_HeII_factor[ix]*(1-x)+AP_Gamma_HeII_factor[ix+1]*x);
 	  }
       }
+
+  if (Memo != NULL) {
+    Memo->rho = rho;
+    Memo->Phot_HI = Rate->Phot_HI;
+    Memo->Phot_HeI = Rate->Phot_HeI;
+    Memo->Phot_HeII = Rate->Phot_HeII;
+  }
+}
+
+void clRates( COOL *cl, RATE *Rate, double T, double rho ) {
+  clRatesMemo( cl, Rate, T, rho, NULL );
+}
+
+void clRatesMemo( COOL *cl, RATE *Rate, double T, double rho, RATEMEMO *Memo ) {
+  double Tln;
+
+  if (T >= cl->TMax) T=cl->TMax*(1.0 - EPS);   
+  if (T < cl->TMin) T=cl->TMin;
+  Tln = log(T); /* Deprecated but log's, sqrt's etc... used in raw rate functions */
+
+  Rate->T = T;
+  Rate->Tln = Tln; 
+  Rate->Coll_HI = clRateCollHI( T );
+  Rate->Coll_HeI = clRateCollHeI( T );
+  Rate->Coll_HeII = clRateCollHeII( T );
+
+  Rate->Radr_HII = clRateRadrHII( T );
+  Rate->Radr_HeII = clRateRadrHeII( T );
+  Rate->Diel_HeII = clRateDielHeII( T );
+  Rate->Chtr_HeII = clRateChtrHeII( T );  
+  Rate->Totr_HeII = Rate->Radr_HeII + Rate->Diel_HeII + Rate->Chtr_HeII;
+  Rate->Radr_HeIII = clRateRadrHeIII( T );
+
+  Rate->iTln = -1; /* Not a table lookup */
+
+  clRatesPhot( cl, Rate, rho, Memo );
 }
 
 #define TABLEINTERPLIN( _rname ) (wTln0*RT0->_rname+wTln1*RT1->_rname)
@@ -772,6 +855,7 @@ void clRates_Table_Lin( COOL *cl, RATE *Rate, double T, double rho) {
   Rate->Chtr_HeII = TABLEINTERPLIN( Rate_Chtr_HeII ); 
   Rate->Totr_HeII = Rate->Radr_HeII + Rate->Diel_HeII + Rate->Chtr_HeII;
   Rate->Radr_HeIII = TABLEINTERPLIN( Rate_Radr_HeIII );
+  Rate->iTln = -1;
 
   Rate->Phot_HI = cl->R.Rate_Phot_HI;
   Rate->Phot_HeI = cl->R.Rate_Phot_HeI;
@@ -797,6 +881,10 @@ void clRates_Table_Lin( COOL *cl, RATE *Rate, double T, double rho) {
 }
 
 void clRates_Table( COOL *cl, RATE *Rate, double T, double rho) {
+  clRates_TableMemo( cl, Rate, T, rho, NULL );
+}
+
+void clRates_TableMemo( COOL *cl, RATE *Rate, double T, double rho, RATEMEMO *Memo ) {
   double Tln;
   double xTln,wTln0,wTln1;/*,wTln0d,wTln1d;*/
   RATES_T *RT0,*RT1;/*,*RT0d,*RT1d;*/
@@ -847,27 +935,15 @@ void clRates_Table( COOL *cl, RATE *Rate, double T, double rho) {
   Rate->Totr_HeII = Rate->Radr_HeII + Rate->Diel_HeII + Rate->Chtr_HeII;
   Rate->Radr_HeIII = TABLEINTERP( Rate_Radr_HeIII );
 
-  Rate->Phot_HI = cl->R.Rate_Phot_HI;
-  Rate->Phot_HeI = cl->R.Rate_Phot_HeI;
-  Rate->Phot_HeII = cl->R.Rate_Phot_HeII;
-  if (cl->bSelfShield) {
-      double logen_B;
-      logen_B = log10(rho*CL_B_gm);
-      if (logen_B > 2.2499) {
-	  Rate->Phot_HI = 0;
-	  Rate->Phot_HeI = 0;
-	  Rate->Phot_HeII = 0;
-	  }
-      else if (logen_B > -10.25) {
-	  double x = (logen_B+10.25)*2.0;
-	  int ix;
-	  ix = floor(x);
-	  x -= ix;
-	  Rate->Phot_HI *= (AP_Gamma_HI_factor[ix]*(1-x)+AP_Gamma_HI_factor[ix+1]*x);
-	  Rate->Phot_HeI *= (AP_Gamma_HeI_factor[ix]*(1-x)+AP_Gamma_HeI_factor[ix+1]*x);
-	  Rate->Phot_HeII *= (AP_Gamma_HeII_factor[ix]*(1-x)+AP_Gamma_HeII_factor[ix+1]*x);
-	  }
-      }
+#ifndef CUBICTABLEINTERP
+  Rate->iTln = iTln;
+  Rate->wTln0 = wTln0;
+  Rate->wTln1 = wTln1;
+#else
+  Rate->iTln = -1;
+#endif
+
+  clRatesPhot( cl, Rate, rho, Memo );
 
 #ifdef TESTRATE
 #define RATEVAR( _name ) (fabs((test._name - Rate->_name)/(test._name)) > TESTRATE)
@@ -898,15 +974,24 @@ void clRates_Table( COOL *cl, RATE *Rate, double T, double rho) {
 
 void clRateMetalTable(COOL *cl, RATE *Rate, double T, double rho, double Y_H, double ZMetal)
 {
-  double tempT, tempnH,tempz, nH;
+  clRateMetalTableMemo(cl, Rate, T, rho, Y_H, ZMetal, NULL);
+}
+
+/*
+ * Metal cooling and heating from the table interpolated to the
+ * current redshift by clRatesRedshift().  The density bin only
+ * depends on nH, so it is kept in the memo while one particle is
+ * integrated.
+ */
+void clRateMetalTableMemo(COOL *cl, RATE *Rate, double T, double rho, double Y_H, double ZMetal, RATEMEMO *Memo)
+{
+  double tempT, tempnH, nH;
   double Tlog, nHlog; 
-  double xTlog, wTlog0, wTlog1, xz, wz0, wz1, xnHlog, wnHlog0, wnHlog1; 
-  int    iTlog, iz, inHlog; 
-  double  Cool000, Cool010, Cool100, Cool110, Cool001, Cool011, Cool101, Cool111; 
-  double  Cool00, Cool01, Cool10, Cool11, Cool0, Cool1, Cool;
-  
-  double  Heat000, Heat010, Heat100, Heat110, Heat001, Heat011, Heat101, Heat111; 
-  double  Heat00, Heat01, Heat10, Heat11, Heat0, Heat1, Heat;
+  double xTlog, wTlog0, wTlog1, xnHlog, wnHlog0, wnHlog1; 
+  int    iTlog, inHlog, nT; 
+  double *p0, *p1;
+  double  Cool0, Cool1, Cool;
+  double  Heat0, Heat1, Heat;
 
   
   if(!cl->bMetal) {
@@ -927,77 +1012,48 @@ void clRateMetalTable(COOL *cl, RATE *Rate, double T, double rho, double Y_H, do
  
   nH = rho*Y_H/M_H;
   
-  tempT = T; 
-  tempnH = nH;
-  tempz = cl->z; 
+  Memo = clRateMemoCheck( cl, Memo );
+  if (Memo != NULL && Memo->nH == nH) {
+    inHlog = Memo->inHlog;
+    wnHlog1 = Memo->wnHlog1;
+  }
+  else {
+    tempnH = nH;
+    if (nH >= cl->MetalnHMax) tempnH = cl->MetalnHMax*(1.0-EPS);
+    if (nH < cl->MetalnHMin) tempnH = cl->MetalnHMin; 
+    nHlog = log10(tempnH); 
+
+    xnHlog = (nHlog - cl->MetalnHlogMin)*cl->rDeltanHlog; 
+    inHlog = xnHlog;
+    if (inHlog == cl->nnHMetalTable - 1) inHlog = cl->nnHMetalTable - 2; /*CC; To prevent running over the table.  Should not be used*/
+    wnHlog1 = xnHlog - inHlog;
+    if (Memo != NULL) {
+      Memo->nH = nH;
+      Memo->inHlog = inHlog;
+      Memo->wnHlog1 = wnHlog1;
+    }
+  }
+  wnHlog0 = 1-wnHlog1; 
 
+  tempT = T; 
   if (T >= cl->MetalTMax) tempT = cl->MetalTMax*(1.0-EPS);
   if (T < cl->MetalTMin) tempT=cl->MetalTMin;
-
-  if (nH >= cl->MetalnHMax) tempnH = cl->MetalnHMax*(1.0-EPS);
-  if (nH < cl->MetalnHMin) tempnH = cl->MetalnHMin; 
- 
-  if (cl->z <= cl->MetalzMin) tempz = cl->MetalzMin+EPS;
-  /* if redshift is too high or no UV, use the no UV metal cooling table*/
-  if (cl->z > cl->MetalzMax || !cl->bUV) tempz = cl->MetalzMax;   
-
   Tlog = log10(tempT); 
-  nHlog = log10(tempnH); 
-  
-  xz = cl->nzMetalTable -1 - (tempz - cl->MetalzMin)*cl->rDeltaz; 
-  iz = xz;   
 
   xTlog = (Tlog - cl->MetalTlogMin)*cl->rDeltaTlog; 
   assert(xTlog >= 0.0);
   iTlog = xTlog; 
 
-  xnHlog = (nHlog - cl->MetalnHlogMin)*cl->rDeltanHlog; 
-  inHlog = xnHlog;
-  if (inHlog == cl->nnHMetalTable - 1) inHlog = cl->nnHMetalTable - 2; /*CC; To prevent running over the table.  Should not be used*/
-  
-  Cool000 = cl->MetalCoolln[iz][inHlog][iTlog];
-  Cool001 = cl->MetalCoolln[iz][inHlog][iTlog+1];
-  Cool010 = cl->MetalCoolln[iz][inHlog+1][iTlog];
-  Cool011 = cl->MetalCoolln[iz][inHlog+1][iTlog+1];
-  Cool100 = cl->MetalCoolln[iz+1][inHlog][iTlog];
-  Cool101 = cl->MetalCoolln[iz+1][inHlog][iTlog+1];
-  Cool110 = cl->MetalCoolln[iz+1][inHlog+1][iTlog];
-  Cool111 = cl->MetalCoolln[iz+1][inHlog+1][iTlog+1];
-
-  Heat000 = cl->MetalHeatln[iz][inHlog][iTlog];
-  Heat001 = cl->MetalHeatln[iz][inHlog][iTlog+1];
-  Heat010 = cl->MetalHeatln[iz][inHlog+1][iTlog];
-  Heat011 = cl->MetalHeatln[iz][inHlog+1][iTlog+1];
-  Heat100 = cl->MetalHeatln[iz+1][inHlog][iTlog];
-  Heat101 = cl->MetalHeatln[iz+1][inHlog][iTlog+1];
-  Heat110 = cl->MetalHeatln[iz+1][inHlog+1][iTlog];
-  Heat111 = cl->MetalHeatln[iz+1][inHlog+1][iTlog+1];
-
-  xz = xz - iz; 
-  wz1 = xz; 
-  wz0 = 1-xz; 
-  
-  Cool00 = wz0*Cool000 + wz1*Cool100;
-  Cool01 = wz0*Cool001 + wz1*Cool101; 
-  Cool10 = wz0*Cool010 + wz1*Cool110; 
-  Cool11 = wz0*Cool011 + wz1*Cool111;
-
-  Heat00 = wz0*Heat000 + wz1*Heat100;
-  Heat01 = wz0*Heat001 + wz1*Heat101; 
-  Heat10 = wz0*Heat010 + wz1*Heat110; 
-  Heat11 = wz0*Heat011 + wz1*Heat111;
-
+  /* [nH][T][cool, heat] */
+  nT = cl->nTMetalTable;
+  p0 = cl->MetalCoolHeatz + 2*(inHlog*nT + iTlog);
+  p1 = p0 + 2*nT;
 
-  xnHlog = xnHlog - inHlog; 
-  wnHlog1 = xnHlog; 
-  wnHlog0 = 1-xnHlog; 
+  Cool0 = wnHlog0*p0[0] + wnHlog1*p1[0]; 
+  Cool1 = wnHlog0*p0[2] + wnHlog1*p1[2]; 
 
-  Cool0 = wnHlog0*Cool00 + wnHlog1*Cool10; 
-  Cool1 = wnHlog0*Cool01 + wnHlog1*Cool11; 
-
-  
-  Heat0 = wnHlog0*Heat00 + wnHlog1*Heat10; 
-  Heat1 = wnHlog0*Heat01 + wnHlog1*Heat11; 
+  Heat0 = wnHlog0*p0[1] + wnHlog1*p1[1]; 
+  Heat1 = wnHlog0*p0[3] + wnHlog1*p1[3];
   
   xTlog = xTlog - iTlog; 
   wTlog1 = xTlog; 
@@ -1747,12 +1803,12 @@ double clEdotInstant_Table( COOL *cl, PERBARYON *Y, RATE *Rate, double rho,
 
   ne = Y->e*en_B;
 
+#ifdef CUBICTABLEINTERP
   xTln = (Rate->Tln-cl->TlnMin)*cl->rDeltaTln;
   iTln = xTln;
   RT0 = (cl->RT+iTln*TABLEFACTOR);
   RT1 = RT0+TABLEFACTOR; 
   xTln = xTln-iTln;
-#ifdef CUBICTABLEINTERP
   RT0d = RT0+1;
   RT1d = RT1+1;
   {
@@ -1767,8 +1823,21 @@ double clEdotInstant_Table( COOL *cl, PERBARYON *Y, RATE *Rate, double rho,
   wTln1d = 0;*/
   }
 #else  
-  wTln1 = xTln;
-  wTln0 = 1-xTln;
+  if (Rate->iTln >= 0) {
+    /* Reuse the interpolation done by clRates_Table() */
+    iTln = Rate->iTln;
+    wTln0 = Rate->wTln0;
+    wTln1 = Rate->wTln1;
+  }
+  else {
+    xTln = (Rate->Tln-cl->TlnMin)*cl->rDeltaTln;
+    iTln = xTln;
+    xTln = xTln-iTln;
+    wTln1 = xTln;
+    wTln0 = 1-xTln;
+  }
+  RT0 = (cl->RT+iTln*TABLEFACTOR);
+  RT1 = RT0+TABLEFACTOR; 
 #endif
 
 #define DTFRACLOWTCOOL 0.25
@@ -1885,8 +1954,8 @@ double clfTemp(void *Data, double T)
 {
   clDerivsData *d = Data; 
   d->its++;
-  CLRATES( d->cl, &d->Rate, T, d->rho );
-  clRateMetalTable(d->cl, &d->Rate, T, d->rho, d->Y_H, d->ZMetal); 
+  CLRATESMEMO( d->cl, &d->Rate, T, d->rho, &d->Memo );
+  clRateMetalTableMemo(d->cl, &d->Rate, T, d->rho, d->Y_H, d->ZMetal, &d->Memo); 
   clAbunds( d->cl, &d->Y, &d->Rate, d->rho, d->ZMetal);
 
   return d->E-clThermalEnergy( d->Y.Total, T );
@@ -1908,8 +1977,8 @@ void clTempIteration( clDerivsData *d )
    T = RootFind(clfTemp, d, TA, TB, EPSTEMP*TA ); 
  } 
  d->its++;
- CLRATES( d->cl, &d->Rate, T, d->rho );
- clRateMetalTable(d->cl, &d->Rate, T, d->rho, d->Y_H, d->ZMetal); 
+ CLRATESMEMO( d->cl, &d->Rate, T, d->rho, &d->Memo );
+ clRateMetalTableMemo(d->cl, &d->Rate, T, d->rho, d->Y_H, d->ZMetal, &d->Memo); 
  clAbunds( d->cl, &d->Y, &d->Rate, d->rho, d->ZMetal);
 }
 
@@ -1937,10 +2006,10 @@ void clDerivs(double x, const double *y, double *dGain, double *dLoss,
 
   d->Y.Total = d->Y.e + d->Y_H + d->Y_He + d->ZMetal/MU_METAL;
   T = clTemperature( d->Y.Total, d->E );
-  CLRATES( d->cl, &d->Rate, T, d->rho ); 
+  CLRATESMEMO( d->cl, &d->Rate, T, d->rho, &d->Memo ); 
   externalheat = d->ExternalHeating;
   if (d->bCool) {
-    clRateMetalTable(d->cl, &d->Rate, T, d->rho, d->Y_H, d->ZMetal);
+    clRateMetalTableMemo(d->cl, &d->Rate, T, d->rho, d->Y_H, d->ZMetal, &d->Memo);
     CLEDOTINSTANT( d->cl, &d->Y, &d->Rate, d->rho, d->ZMetal, &internalheat, &internalcool );
     
     dGain[0] = internalheat;
@@ -2168,7 +2237,7 @@ void clIntegrateEnergy(COOL *cl, clDerivsData *clData, PERBARYON *Y, double *E,
      double  T = clTemperature( Y->Total, *E ), ne = en_B*Y->e;
      RATE *Rate = &d->Rate;
 
-     CLRATES( d->cl, &d->Rate, T, d->rho);
+     CLRATESMEMO( d->cl, &d->Rate, T, d->rho, &d->Memo );
 #define DTFRACLOWTCOOL 0.25
      if (Rate->T > cl->R.Tcmb*(1+DTFRACLOWTCOOL))
        LowTCool = clCoolLowT(Rate->T)*cl->R.Cool_LowTFactor*en_B*ZMetal;
@@ -159,6 +159,11 @@ typedef struct CoolingPKDStruct {
   double      rDeltaz;
   float       ***MetalCoolln;
   float       ***MetalHeatln;  
+  /* Metal table interpolated to the current redshift, with cooling and
+     heating interleaved: [nH][T][2]; set by clRatesRedshift() */
+  double      *MetalCoolHeatz;
+  /* Incremented by clRatesRedshift() to invalidate RATEMEMOs */
+  int         iRatesGen;
   
   int        nTableRead; /* number of Tables read from files */
 
@@ -200,8 +205,25 @@ typedef struct {
   double   Phot_HI;
   double   Phot_HeI;
   double   Phot_HeII;
+  /* Interpolation bin and weights of Tln in the rates table; set by
+     clRates_Table() for clEdotInstant_Table() */
+  int      iTln;
+  double   wTln0, wTln1;
 } RATE;
 
+/* Density dependent parts of the rates, remembered while one particle
+   is integrated */
+typedef struct {
+  int      iGen;     /* cl->iRatesGen these are valid for */
+  double   rho;      /* density of the self shielded rates below */
+  double   Phot_HI;
+  double   Phot_HeI;
+  double   Phot_HeII;
+  double   nH;       /* density of the metal table bin below */
+  int      inHlog;
+  double   wnHlog1;
+} RATEMEMO;
+
 typedef struct {
   double compton;
   double bremHII;
@@ -228,6 +250,7 @@ struct clDerivsDataStruct {
   double rho,ExternalHeating,E,ZMetal;
 /*  double Y_H, Y_He; */  /* will be needed -- also for temperature , Y_MetalIon, Y_eMetal */
   RATE Rate;
+  RATEMEMO Memo;
   PERBARYON Y;
   double     Y_H, Y_He, Y_eMax;
   double     Y_Total0, Y_Total1;
@@ -246,6 +269,7 @@ void clInitUV(COOL *cl, int nTableColumns, int nTableRows, double *dTableData );
 void clInitRatesTable( COOL *cl, double TMin, double TMax, int nTable );
 void clReadMetalTable(COOL *cl, COOLPARAM clParam);
 void clRateMetalTable(COOL *cl, RATE *Rate, double T, double rho, double Y_H, double ZMetal); 
+void clRateMetalTableMemo(COOL *cl, RATE *Rate, double T, double rho, double Y_H, double ZMetal, RATEMEMO *Memo);
 void clHHeTotal(COOL *cl, double ZMetal); 
 void CoolInitRatesTable( COOL *cl, COOLPARAM CoolParam);
 
@@ -253,6 +277,9 @@ void clRatesTableError( COOL *cl );
 void clRatesRedshift( COOL *cl, double z, double dTime );
 double clHeatTotal ( COOL *cl, PERBARYON *Y, RATE *Rate  );
 void clRates( COOL *cl, RATE *Rate, double T, double rho);
+void clRatesMemo( COOL *cl, RATE *Rate, double T, double rho, RATEMEMO *Memo );
+void clRates_Table( COOL *cl, RATE *Rate, double T, double rho);
+void clRates_TableMemo( COOL *cl, RATE *Rate, double T, double rho, RATEMEMO *Memo );
 double clCoolTotal( COOL *cl, PERBARYON *Y, RATE *Rate, double rho, double ZMetal );
 COOL_ERGPERSPERGM  clTestCool ( COOL *cl, PERBARYON *Y, RATE *Rate, double rho );
 void clPrintCool( COOL *cl, PERBARYON *Y, RATE *Rate, double rho );
@@ -63,7 +63,9 @@ void ExternalGravity::CheckParams(PRM prm, struct parameters &param)
  *
  * Applies an acceleration on every particle on the current tree piece that is on
  * or above the current rung. This function also keeps track of the acceleration on 
- * the potential imparted by the particles.
+ * the potential imparted by the particles.  Each enabled potential is
+ * applied in its own loop over the active particles, so the choice of
+ * potential is made once rather than per particle.
  *
  * @param iKickRung The current rung that we are on
  * @param exGrav A reference to the ExternalGravity class
@@ -81,17 +83,29 @@ void TreePiece::externalGravity(int iKickRung, const ExternalGravity exGrav,
     frameAcc[0] = 0.0;
     frameAcc[1] = 0.0;
     frameAcc[2] = 0.0;
-    Vector3D<double> pFrameAcc;
 
-    for(unsigned int i = 1; i <= myNumParticles; ++i) {
-        GravityParticle *p = &myParticles[i];
-        if(p->rung >= iKickRung) {
-            pFrameAcc = exGrav.applyPotential(p);
+    int nActive = rungOrderActive(iKickRung);
+    if(exGrav.bBodyForce) {
+        for(int k = 0; k < nActive; ++k)
+            exGrav.applyBodyForce(&myParticles[rungOrder[k]]);
+        }
+    if(exGrav.bPatch) {
+        for(int k = 0; k < nActive; ++k)
+            exGrav.applyPatch(&myParticles[rungOrder[k]]);
+        }
+    if(exGrav.bCentralBody) {
+        for(int k = 0; k < nActive; ++k) {
+            Vector3D<double> pFrameAcc
+                = exGrav.applyCentralBody(&myParticles[rungOrder[k]]);
             frameAcc[0] += pFrameAcc[0];
             frameAcc[1] += pFrameAcc[1];
             frameAcc[2] += pFrameAcc[2];
             }
         }
+    if(exGrav.bLogarithmicHalo) {
+        for(int k = 0; k < nActive; ++k)
+            exGrav.applyLogarithmicHalo(&myParticles[rungOrder[k]]);
+        }
     contribute(sizeof(frameAcc), frameAcc, CkReduction::sum_double, cb);
     }
 
@@ -106,105 +120,123 @@ void TreePiece::externalGravity(int iKickRung, const ExternalGravity exGrav,
 Vector3D<double> ExternalGravity::applyPotential(GravityParticle *p) const
 {
     Vector3D<double> pFrameAcc(0., 0., 0.);
-    if (bBodyForce) {
-        if(p->position.z > 0.0) {
-            p->treeAcceleration.z -= dBodyForceConst;
-            p->potential += dBodyForceConst*p->potential;
-            double idt2 = dBodyForceConst/p->position.z;
-            if(idt2 > p->dtGrav)
-                p->dtGrav = idt2;
-            }
-        else {
-            p->treeAcceleration.z += dBodyForceConst;
-            p->potential -= dBodyForceConst*p->position.z;
-            if (p->position.z != 0.0) {
-                double idt2 = -dBodyForceConst/p->position.z;
-                if (idt2 > p->dtGrav)
-                    p->dtGrav = idt2;
-                }
-            }
+    if (bBodyForce)
+        applyBodyForce(p);
+    if (bPatch)
+        applyPatch(p);
+    if(bCentralBody)
+        pFrameAcc = applyCentralBody(p);
+    if(bLogarithmicHalo)
+        applyLogarithmicHalo(p);
+    return pFrameAcc;
     }
 
-    if (bPatch) {
-        double r2 = dOrbDist*dOrbDist + p->position.z*p->position.z;
-        double idt2 = dCentMass*pow(r2, -1.5);
-
-        p->treeAcceleration.z -= dCentMass*p->position.z
-                                 *pow(r2, -1.5);
-        p->potential += dCentMass/sqrt(r2);
-        if(idt2 > p->dtGrav)
-            p->dtGrav = idt2;
-        }
-
-    if(bCentralBody) {
-        double px = p->position.x;
-        double py = p->position.y;
-        double pz = p->position.z;
-        double r = p->position.length();
-        
-        // Legendre polynomials
-        double c1 = pz/r;                  // cos(theta)
-        double c2 = sqrt(px*px + py*py)/r; // sin(theta)
-        double p2 = 0.5*(3.*pow(c1, 2) - 1.);
-        double p4 = 1./8.*(35.*pow(c1, 4) - 30.*pow(c1, 2) + 3.);
-        double p6 = 1./16.*(231.*pow(c1, 6) - 315.*pow(c1, 4)
-                              + 105.*pow(c1, 2) - 5.);
-        
-        // Theta derivatives of legendre polynomials
-        double p2prime = -3.*c1*c2;
-        double p4prime = -5./16.*(4.*c1*c2 + 28.*pow(c1, 2)*c2*(2.*pow(c1, 2) - 1.));
-        double p6prime = -1./16.*(1386.*c2*pow(c1, 5)
-                                 - 1260.*c2*pow(c1, 3)+ 210.*c1*c2);
-
-        double a2 = dJ2*pow(dEqRad/r, 2);
-        double a4 = dJ4*pow(dEqRad/r, 4);
-        double a6 = dJ6*pow(dEqRad/r, 6);
-
-        p->potential += -dCentMass/r*(1. - a2*p2 - a4*p4 - a6*p6);
-
-        // Acceleration in spherical coordinates
-        double ar = -dCentMass/pow(r, 2)*(1. - 3.*a2*p2 -5.*a4*p4 - 7.*a6*p6);
-        double atheta = -dCentMass/pow(r, 2)*(a2*p2prime
-                          + a4*p4prime + a6*p6prime);
-
-        Vector3D<double> rVec = p->position/r;
-        double c = (r*sqrt(px*px+py*py));
-        Vector3D<double> thetaVec(px*pz/c, py*pz/c, -(px*px + py*py)/c);
-        Vector3D<double> a = ar*rVec + atheta*thetaVec;
-
-        p->treeAcceleration += a;
-        pFrameAcc = -a*p->mass/dCentMass;
-
-        double idt2 = fabs(ar/r);
+/// @brief Constant acceleration towards the z = 0 plane.
+void ExternalGravity::applyBodyForce(GravityParticle *p) const
+{
+    if(p->position.z > 0.0) {
+        p->treeAcceleration.z -= dBodyForceConst;
+        p->potential += dBodyForceConst*p->potential;
+        double idt2 = dBodyForceConst/p->position.z;
         if(idt2 > p->dtGrav)
             p->dtGrav = idt2;
         }
-        
-    if(bLogarithmicHalo) {
-        double px = p->position.x;
-        double py = p->position.y;
-        double pz = p->position.z;
-        double r = p->position.length();
-        
-        // Form of Logarithmic Halo Potential
-        double v0 = 1.0;
-        double qy = 0.9;
-        double qz = 0.7;
-        double core = sqrt(0.1);
-        p->potential += v0*v0*log(px*px + (py/qy)*(py/qy) + (pz/qz)*(pz/qz) + core*core); // Written as double the true value to account for divide-by-two issue in ChaNGa integration
-        
-        // Acceleration in Cartesian coordinates
-        double ax = -v0*v0*px/(px*px + (py/qy)*(py/qy) + (pz/qz)*(pz/qz) + core*core);
-        double ay = -v0*v0*py/((qy*qy)*(px*px + (py/qy)*(py/qy) + (pz/qz)*(pz/qz) + core*core));
-        double az = -v0*v0*pz/((qz*qz)*(px*px + (py/qy)*(py/qy) + (pz/qz)*(pz/qz) + core*core));
-        Vector3D<double> a(ax, ay, az);
-        p->treeAcceleration += a;
-        
-        double idt2 = (v0*v0)/(r*r + core*core);
-        if(idt2 > p->dtGrav)
-            p->dtGrav = idt2;
+    else {
+        p->treeAcceleration.z += dBodyForceConst;
+        p->potential -= dBodyForceConst*p->position.z;
+        if (p->position.z != 0.0) {
+            double idt2 = -dBodyForceConst/p->position.z;
+            if (idt2 > p->dtGrav)
+                p->dtGrav = idt2;
+            }
         }
-    return pFrameAcc;
+    }
+
+/// @brief Vertical gravity of the central mass in a disk patch.
+void ExternalGravity::applyPatch(GravityParticle *p) const
+{
+    double r2 = dOrbDist*dOrbDist + p->position.z*p->position.z;
+    double idt2 = dCentMass*pow(r2, -1.5);
+
+    p->treeAcceleration.z -= dCentMass*p->position.z
+                             *pow(r2, -1.5);
+    p->potential += dCentMass/sqrt(r2);
+    if(idt2 > p->dtGrav)
+        p->dtGrav = idt2;
+    }
+
+/// @brief Oblate central body at the origin.
+/// @return The acceleration on the central body by particle p
+Vector3D<double> ExternalGravity::applyCentralBody(GravityParticle *p) const
+{
+    double px = p->position.x;
+    double py = p->position.y;
+    double pz = p->position.z;
+    double r = p->position.length();
+    
+    // Legendre polynomials
+    double c1 = pz/r;                  // cos(theta)
+    double c2 = sqrt(px*px + py*py)/r; // sin(theta)
+    double p2 = 0.5*(3.*pow(c1, 2) - 1.);
+    double p4 = 1./8.*(35.*pow(c1, 4) - 30.*pow(c1, 2) + 3.);
+    double p6 = 1./16.*(231.*pow(c1, 6) - 315.*pow(c1, 4)
+                          + 105.*pow(c1, 2) - 5.);
+    
+    // Theta derivatives of legendre polynomials
+    double p2prime = -3.*c1*c2;
+    double p4prime = -5./16.*(4.*c1*c2 + 28.*pow(c1, 2)*c2*(2.*pow(c1, 2) - 1.));
+    double p6prime = -1./16.*(1386.*c2*pow(c1, 5)
+                             - 1260.*c2*pow(c1, 3)+ 210.*c1*c2);
+
+    double a2 = dJ2*pow(dEqRad/r, 2);
+    double a4 = dJ4*pow(dEqRad/r, 4);
+    double a6 = dJ6*pow(dEqRad/r, 6);
+
+    p->potential += -dCentMass/r*(1. - a2*p2 - a4*p4 - a6*p6);
+
+    // Acceleration in spherical coordinates
+    double ar = -dCentMass/pow(r, 2)*(1. - 3.*a2*p2 -5.*a4*p4 - 7.*a6*p6);
+    double atheta = -dCentMass/pow(r, 2)*(a2*p2prime
+                      + a4*p4prime + a6*p6prime);
+
+    Vector3D<double> rVec = p->position/r;
+    double c = (r*sqrt(px*px+py*py));
+    Vector3D<double> thetaVec(px*pz/c, py*pz/c, -(px*px + py*py)/c);
+    Vector3D<double> a = ar*rVec + atheta*thetaVec;
+
+    p->treeAcceleration += a;
+
+    double idt2 = fabs(ar/r);
+    if(idt2 > p->dtGrav)
+        p->dtGrav = idt2;
+    return -a*p->mass/dCentMass;
+    }
+
+/// @brief Logarithmic halo potential.
+void ExternalGravity::applyLogarithmicHalo(GravityParticle *p) const
+{
+    double px = p->position.x;
+    double py = p->position.y;
+    double pz = p->position.z;
+    double r = p->position.length();
+    
+    // Form of Logarithmic Halo Potential
+    double v0 = 1.0;
+    double qy = 0.9;
+    double qz = 0.7;
+    double core = sqrt(0.1);
+    p->potential += v0*v0*log(px*px + (py/qy)*(py/qy) + (pz/qz)*(pz/qz) + core*core); // Written as double the true value to account for divide-by-two issue in ChaNGa integration
+    
+    // Acceleration in Cartesian coordinates
+    double ax = -v0*v0*px/(px*px + (py/qy)*(py/qy) + (pz/qz)*(pz/qz) + core*core);
+    double ay = -v0*v0*py/((qy*qy)*(px*px + (py/qy)*(py/qy) + (pz/qz)*(pz/qz) + core*core));
+    double az = -v0*v0*pz/((qz*qz)*(px*px + (py/qy)*(py/qy) + (pz/qz)*(pz/qz) + core*core));
+    Vector3D<double> a(ax, ay, az);
+    p->treeAcceleration += a;
+    
+    double idt2 = (v0*v0)/(r*r + core*core);
+    if(idt2 > p->dtGrav)
+        p->dtGrav = idt2;
     }
 
 /*
@@ -216,11 +248,9 @@ Vector3D<double> ExternalGravity::applyPotential(GravityParticle *p) const
  */
 void TreePiece::applyFrameAcc(int iKickRung, Vector3D<double> frameAcc, const CkCallback& cb)
 {
-    for (unsigned int i = 1; i <= myNumParticles; ++i) {
-        GravityParticle *q = &myParticles[i];
-        if(q->rung >= iKickRung)
-            q->treeAcceleration -= frameAcc; 
-        }
+    int nActive = rungOrderActive(iKickRung);
+    for(int k = 0; k < nActive; ++k)
+        myParticles[rungOrder[k]].treeAcceleration -= frameAcc;
 
     contribute(cb);
     }
@@ -21,6 +21,10 @@ public:
     void AddParams(PRM prm);
     void CheckParams(PRM prm, struct parameters &param);
     Vector3D<double> applyPotential(GravityParticle *p) const;
+    void applyBodyForce(GravityParticle *p) const;
+    void applyPatch(GravityParticle *p) const;
+    Vector3D<double> applyCentralBody(GravityParticle *p) const;
+    void applyLogarithmicHalo(GravityParticle *p) const;
     inline void pup(PUP::er &p);
     };
 
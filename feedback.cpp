@@ -726,6 +726,30 @@ void DistStellarFeedbackSmoothParams::combSmoothCache(GravityParticle *p1,
     }
     }
 
+/// Fields read by DistStellarFeedbackSmoothParams::combSmoothCache()
+static const SmoothCacheField aFeedbackCacheFields[] = {
+    SMOOTH_CACHE_FIELD(mass),
+    SMOOTH_CACHE_FIELD(curlv),
+#ifdef SUPERBUBBLE
+    SMOOTH_CACHE_FIELD(massHot),
+#endif
+    SMOOTH_CACHE_FIELD(fESNrate),
+    SMOOTH_CACHE_FIELD(fMetals),
+    SMOOTH_CACHE_FIELD(fMFracOxygen),
+    SMOOTH_CACHE_FIELD(fMFracIron),
+    SMOOTH_CACHE_FIELD(fTimeCoolIsOffUntil),
+    SMOOTH_CACHE_FIELD(dTimeFB),
+    SMOOTH_CACHE_FIELD(u),
+    SMOOTH_CACHE_FIELD(uPred),
+};
+
+const SmoothCacheField *
+DistStellarFeedbackSmoothParams::smoothCacheFields(int &nFields)
+{
+    nFields = sizeof(aFeedbackCacheFields)/sizeof(aFeedbackCacheFields[0]);
+    return aFeedbackCacheFields;
+    }
+
 void DistStellarFeedbackSmoothParams::DistFBMME(GravityParticle *p,int nSmooth, pqSmoothNode *nList)
 {
     GravityParticle *q;
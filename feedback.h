@@ -253,6 +253,7 @@ class DistStellarFeedbackSmoothParams : public SmoothParams
     virtual void initSmoothCache(GravityParticle *p);
     virtual void combSmoothCache(GravityParticle *p1,
 				 ExternalSmoothParticle *p2);
+    virtual const SmoothCacheField *smoothCacheFields(int &nFields);
     void DistFBMME(GravityParticle *p, int nSmooth, pqSmoothNode *nList);
  public:
     DistStellarFeedbackSmoothParams() {}
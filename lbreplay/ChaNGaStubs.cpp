@@ -0,0 +1,24 @@
+/// @file ChaNGaStubs.cpp
+/// Definitions the ChaNGa load balancing modules take from the ChaNGa
+/// main module (ParallelGravity.cpp).  lbreplay does not link that
+/// module, so they are provided here.  The parameters have the defaults
+/// of the ChaNGa parameter file; lbreplay sets some of them from its
+/// command line.
+
+#include "ParallelGravity.h"
+#include "LBCapture.h"
+
+/// Never bound to a TreePiece array: the balancers only declare it.
+CProxy_TreePiece treeProxy;
+
+double dMaxBalance = 1e10;
+int bLBIncremental = 0;
+double dLBMaxMigrate = 0.0;
+double dCommLBTolerance = 1.05;
+int nCommLBPasses = 4;
+
+int doDumpLB = 0;
+int lbDumpIteration = 0;
+int doSimulateLB = 0;
+/// Replayed strategies must not write captures of their own.
+int bLBCapture = 0;
@@ -0,0 +1,138 @@
+/// @file LBReplay.cpp
+/// Offline replay of ChaNGa load balancing strategies on LB databases
+/// captured with the bLBCapture parameter.  See README in this
+/// directory.
+
+#include <charm++.h>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include "LBCapture.h"
+#include "MultistepLB.h"
+#include "MultistepLB_SFC.h"
+#include "MultistepLB_notopo.h"
+#include "MultistepCommLB.h"
+#include "MultistepNodeLB_notopo.h"
+#include "Orb3dLB.h"
+#include "Orb3dLB_notopo.h"
+#include "LBReplay.decl.h"
+
+/// @brief Instantiate a strategy by name outside of the LB framework.
+/// @return NULL if the name is not recognized.
+static CentralLB *makeStrategy(const std::string &name)
+{
+    CkMigrateMessage *m = static_cast<CkMigrateMessage *>(nullptr);
+    if(name == "MultistepLB")
+        return new MultistepLB(m);
+    if(name == "MultistepLB_notopo")
+        return new MultistepLB_notopo(m);
+    if(name == "MultistepNodeLB_notopo")
+        return new MultistepNodeLB_notopo(m);
+    if(name == "MultistepLB_SFC")
+        return new MultistepLB_SFC(m);
+    if(name == "MultistepCommLB")
+        return new MultistepCommLB(m);
+    if(name == "Orb3dLB")
+        return new Orb3dLB(m);
+    if(name == "Orb3dLB_notopo")
+        return new Orb3dLB_notopo(m);
+    return NULL;
+}
+
+static void usage()
+{
+    CkPrintf("USAGE: charmrun +p<N> lbreplay [-i] [-m <MB>] -s <Strategy> [-s <Strategy> ...] <capture file> ...\n");
+    CkPrintf("Strategies: MultistepLB MultistepLB_notopo MultistepNodeLB_notopo\n");
+    CkPrintf("            MultistepLB_SFC MultistepCommLB Orb3dLB Orb3dLB_notopo\n");
+    CkPrintf("-i: incremental ORB (bLBIncremental); -m: migration bound in MB (dLBMaxMigrate)\n");
+    CkPrintf("N should match the number of processors of the captured run.\n");
+}
+
+/// @brief Set the LB step seen by the strategies to that of the capture.
+static void setLBStep(int iStep)
+{
+#ifdef LB_MANAGER_VERSION
+    LBManager *lbMgr = LBManagerObj();
+#else
+    LBDatabase *lbMgr = LBDatabaseObj();
+#endif
+    CkMustAssert(lbMgr->step() <= iStep, "captures must be given in step order");
+    while(lbMgr->step() < iStep)
+        lbMgr->incStep();
+}
+
+class LBReplay : public CBase_LBReplay {
+ public:
+    LBReplay(CkArgMsg *m);
+};
+
+LBReplay::LBReplay(CkArgMsg *m)
+{
+    std::vector<std::string> strategies;
+    std::vector<std::string> files;
+    for(int i = 1; i < m->argc; i++) {
+        std::string arg(m->argv[i]);
+        if(arg == "-s" && i + 1 < m->argc)
+            strategies.push_back(m->argv[++i]);
+        else if(arg == "-i")
+            bLBIncremental = 1;
+        else if(arg == "-m" && i + 1 < m->argc)
+            dLBMaxMigrate = atof(m->argv[++i]);
+        else
+            files.push_back(arg);
+    }
+    delete m;
+
+    if(strategies.empty() || files.empty()) {
+        usage();
+        CkExit();
+        return;
+    }
+
+    std::vector<CentralLB *> lbs;
+    for(const auto &name : strategies) {
+        CentralLB *lb = makeStrategy(name);
+        if(lb == NULL) {
+            CkError("Unknown strategy %s\n", name.c_str());
+            usage();
+            CkExit();
+            return;
+        }
+        lbs.push_back(lb);
+    }
+
+    for(const auto &file : files) {
+        LBCapture capture;
+        if(!read_LB_capture(capture, file.c_str())) {
+            CkError("Could not open capture %s\n", file.c_str());
+            continue;
+        }
+        CkPrintf("Capture %s: %s step %d objects %lu processors %lu nodes %d\n",
+                 file.c_str(), capture.strategy.c_str(), capture.step,
+                 capture.objs.size(), capture.procs.size(), capture.numNodes);
+        if((int) capture.procs.size() != CkNumPes()
+           || capture.numNodes != CkNumNodes())
+            CkError("WARNING: replaying on %d processors %d nodes; node and topology aware strategies may not reproduce the run\n",
+                    CkNumPes(), CkNumNodes());
+        setLBStep(capture.step);
+
+        for(size_t iLB = 0; iLB < lbs.size(); iLB++) {
+            BaseLB::LDStats *stats = new BaseLB::LDStats(capture.procs.size());
+            capture.restore(stats);
+
+            double dStartTime = CkWallTimer();
+            lbs[iLB]->work(stats);
+            double dDecisionTime = CkWallTimer() - dStartTime;
+
+            LBCapture_PrintEval(stats, strategies[iLB].c_str(), dDecisionTime);
+            delete stats;
+        }
+    }
+
+    for(auto lb : lbs)
+        delete lb;
+    CkExit();
+}
+
+#include "LBReplay.def.h"
@@ -156,6 +156,17 @@ typedef struct parameters {
     double dExtraStore;
     double dMaxBalance;
     double dFracLoadBalance;
+    double dLBLoadSmooth;
+    int bLBIncremental;
+    double dLBMaxMigrate;
+    double dCommLBTolerance;
+    int nCommLBPasses;
+    int bSmoothReuse;
+    double dSmoothSkin;
+    int bSnapKeyBox;
+    double dSmoothPredict;
+    int iSPHKernel;
+    int bSPHKernelTable;
     double dDumpFrameStep;
     double dDumpFrameTime;
     int iDirector;
@@ -295,6 +306,17 @@ inline void operator|(PUP::er &p, Parameters &param) {
     p|param.dExtraStore;
     p|param.dMaxBalance;
     p|param.dFracLoadBalance;
+    p|param.dLBLoadSmooth;
+    p|param.bLBIncremental;
+    p|param.dLBMaxMigrate;
+    p|param.dCommLBTolerance;
+    p|param.nCommLBPasses;
+    p|param.bSmoothReuse;
+    p|param.dSmoothSkin;
+    p|param.bSnapKeyBox;
+    p|param.dSmoothPredict;
+    p|param.iSPHKernel;
+    p|param.bSPHKernelTable;
     p|param.dDumpFrameStep;
     p|param.dDumpFrameTime;
     p|param.iDirector;
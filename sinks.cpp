@@ -339,6 +339,7 @@ void TreePiece::SinkStep(int iCurrSinkRung, int iKickRung,
            if(iCurrSinkRung > p->rung) p->rung = iCurrSinkRung;
            }
         }
+    invalidateRungOrder();
     contribute(cb);
     }
 
@@ -926,10 +927,10 @@ void Main::doSinks(double dTime, double dDelta, int iKickRung)
 	    }
 	else {
 	    /* Fixed Radius Accretion: particle by particle (cf. Bate) */
+	    /* All gas within dSinkRadius, not just the nSmooth nearest */
 	    SinkAccreteTestSmoothParams pSinkTest(TYPE_GAS, iKickRung, dTime,
 						  param.sinks);
-	    treeProxy.startSmooth(&pSinkTest, 1, param.nSmooth,
-				  dfBall2OverSoft2, CkCallbackResumeThread());
+	    treeProxy.startBallSmooth(&pSinkTest, CkCallbackResumeThread());
 	    
 #ifdef SINKINGAVERAGE
 	    msrActiveType(msr,TYPE_NEWSINKING, TYPE_SMOOTHACTIVE);
@@ -940,8 +941,7 @@ void Main::doSinks(double dTime, double dDelta, int iKickRung)
 #endif
 	    SinkAccreteSmoothParams pSinkAcc(TYPE_GAS, iKickRung, dTime,
 					     param.sinks);
-	    treeProxy.startSmooth(&pSinkAcc, 1, param.nSmooth,
-				  dfBall2OverSoft2, CkCallbackResumeThread());
+	    treeProxy.startBallSmooth(&pSinkAcc, CkCallbackResumeThread());
 	    }
 	
 	addDelParticles();
@@ -366,6 +366,8 @@ class SinkAccreteTestSmoothParams : public SmoothParams
     virtual void initSmoothCache(GravityParticle *p);
     virtual void combSmoothCache(GravityParticle *p1,
 				 ExternalSmoothParticle *p2);
+    /// Accretion is within a fixed radius of the sink.
+    virtual double fBallQuery(GravityParticle *p) { return s.dSinkRadius; }
  public:
     SinkAccreteTestSmoothParams() {}
     SinkAccreteTestSmoothParams(int _iType, int am, double dTime,
@@ -427,6 +429,8 @@ class SinkAccreteSmoothParams : public SmoothParams
     virtual void initSmoothCache(GravityParticle *p);
     virtual void combSmoothCache(GravityParticle *p1,
 				 ExternalSmoothParticle *p2);
+    /// Accretion is within a fixed radius of the sink.
+    virtual double fBallQuery(GravityParticle *p) { return s.dSinkRadius; }
  public:
     SinkAccreteSmoothParams() {}
     SinkAccreteSmoothParams(int _iType, int am, double dTime,
@@ -43,10 +43,6 @@
 #include "Space.h"
 #include <float.h>
 
-/// Point to the smooth parameters during a smooth walk.  This is for
-/// use by the EntryTypeSmoothParticle::unpack() method.
-
-SmoothParams *globalSmoothParams;
 
 /*
  * There is actually not much "work" for the smooth walk.  This method
@@ -85,6 +81,8 @@ int SmoothCompute::doWork(GenericTreeNode *node, // Node to test
     else if(action == KEEP_LOCAL_BUCKET) {
 	// Search bucket for contained particles
 	GravityParticle *part = node->particlePointer;
+	if(bRecordRefs)
+	    recordBucket(node, part, chunk, reqID);
 	
 	for(int i = node->firstParticle; i <= node->lastParticle; i++) {
 	    if(!TYPETest(&part[i-node->firstParticle], params->iType))
@@ -100,6 +98,8 @@ int SmoothCompute::doWork(GenericTreeNode *node, // Node to test
 	}
     else if(action == KEEP_REMOTE_BUCKET) {
 	GravityParticle *part;
+	if(bRecordRefs)
+	    recordBucket(node, NULL, chunk, reqID);
 	part = tp->requestSmoothParticles(node->getKey(), 
 				    chunk, 
 				    node->remoteIndex, 
@@ -149,6 +149,23 @@ void SmoothCompute::nodeMissedEvent(int reqID, int chunk, State *state, TreePiec
     state->counterArrays[0][reqIDlist]++;
     }
 
+/// @brief Record a bucket kept by the walk for the bucket in reqID.
+/// @param part Bucket particles if they are on this PE, otherwise NULL.
+void SmoothCompute::recordBucket(GenericTreeNode *node, GravityParticle *part,
+				 int chunk, int reqID)
+{
+    SmoothBucketRef ref;
+    ref.particles = part;
+    ref.key = node->getKey();
+    ref.remoteIndex = node->remoteIndex;
+    ref.firstParticle = node->firstParticle;
+    ref.lastParticle = node->lastParticle;
+    ref.chunk = chunk;
+    ref.reqID = reqID;
+    ref.boundingBox = node->boundingBox;
+    tp->recordSmoothBucket(decodeReqID(reqID), ref);
+    }
+
 // called after constructor, so tp should be set
 State *KNearestSmoothCompute::getNewState(int nBuckets){
   NearNeighborState *state = new NearNeighborState(tp->myNumParticles+2, nSmooth);
@@ -217,7 +234,7 @@ int KNearestSmoothCompute::openCriterion(TreePiece *ownerTP,
 	return 0;
 
     for(int j = myNode->firstParticle; j <= myNode->lastParticle; ++j) {
-	if(!params->isSmoothActive(&particles[j]))
+	if(!nstate->bActive[j])
 	    continue;
 	double r2 = nstate->Qs[j][0].fKey; // Ball radius^2
 	if(intersect(node->boundingBox, particles[j].position - offset, r2)) {
@@ -229,9 +246,33 @@ int KNearestSmoothCompute::openCriterion(TreePiece *ownerTP,
 
 inline double sqr(double x) { return x*x; }
 
+/// @brief Replace the top (largest) entry of a max heap with pqNew
+/// and restore heap order.  This is one sift down rather than a
+/// pop_heap() followed by a push_heap().
+static inline void pqReplaceTop(pqSmoothNode *heap, int n,
+                                const pqSmoothNode &pqNew)
+{
+    int i = 0;
+    for(;;) {
+	int c = 2*i + 1;
+	if(c >= n)
+	    break;
+	if(c + 1 < n && heap[c] < heap[c+1])
+	    c++;
+	if(!(pqNew < heap[c]))
+	    break;
+	heap[i] = heap[c];
+	i = c;
+	}
+    heap[i] = pqNew;
+    }
+
 /**
  * Test a given particle against all the priority queues in the
- * bucket.
+ * bucket.  The distances to all the bucket particles are computed
+ * first in a loop over the structure of arrays positions that the
+ * compiler can vectorize; only particles within a search radius
+ * touch a queue.
  */
 
 void KNearestSmoothCompute::bucketCompare(TreePiece *ownerTP,
@@ -248,20 +289,36 @@ void KNearestSmoothCompute::bucketCompare(TreePiece *ownerTP,
     Vector3D<double> drBucket = node->centerSm - rp;
     if(sqr(node->sizeSm + node->fKeyMax) < drBucket.lengthSquared())
 	return;		// particle is outside all smoothing radii
+    const int iFirst = node->firstParticle;
+    const int nPart = node->lastParticle - iFirst + 1;
+    const double *x = nstate->xPos + iFirst;
+    const double *y = nstate->yPos + iFirst;
+    const double *z = nstate->zPos + iFirst;
+    double *dr2 = &nstate->dr2[0];
+    const double rx = rp.x;
+    const double ry = rp.y;
+    const double rz = rp.z;
+    for(int k = 0; k < nPart; ++k) {
+	double dx = x[k] - rx;
+	double dy = y[k] - ry;
+	double dz = z[k] - rz;
+	dr2[k] = dx*dx + dy*dy + dz*dz;
+	}
+
     double dKeyMaxBucket = 0.0;
-    for(int j = node->firstParticle; j <= node->lastParticle; ++j) {
-	if(!params->isSmoothActive(&particles[j]))
+    for(int k = 0; k < nPart; ++k) {
+	const int j = iFirst + k;
+	if(!nstate->bActive[j])
 	    continue;
 	CkVec<pqSmoothNode> &Q = nstate->Qs[j];
 	double rOld2 = Q[0].fKey; // Ball radius
-	Vector3D<double> dr = particles[j].position - rp;
 	
 	// include particle if less than the current search radius, or
 	// less than the h_min limit set by softening.
-	if(rOld2 >= dr.lengthSquared()) {
+	if(rOld2 >= dr2[k]) {
 	    pqSmoothNode pqNew;
-	    pqNew.fKey = dr.lengthSquared();
-	    pqNew.dx = dr;
+	    pqNew.fKey = dr2[k];
+	    pqNew.dx = particles[j].position - rp;
 	    pqNew.p = p;
 	    // Perform replacement if we've got enough particles and
 	    // we are not hitting the h_min limit.
@@ -269,6 +326,10 @@ void KNearestSmoothCompute::bucketCompare(TreePiece *ownerTP,
 		Q.push_back(pqNew);
 		Q[0].fKey = dfBall2OverSoft2*sqr(particles[j].soft);
 		}
+	    else if(Q.size() == nSmooth) {
+		// Full queue: the new particle replaces the farthest.
+		pqReplaceTop(&(Q[0]), nSmooth, pqNew);
+		}
 	    else {
 		if(Q.size() >= nSmooth) {
 		    std::pop_heap(&(Q[0]) + 0, &(Q[0]) + nSmooth);
@@ -327,7 +388,7 @@ void TreePiece::setupSmooth() {
   if (myNumParticles == 0) {
     // No particles assigned to this TreePiece
       for (int i=0; i< numChunks; ++i) {
-	  cacheSmoothPart[CkMyPe()].finishedChunk(i, 0);
+	  smoothCacheFinishedChunk(i);
 	  }
       return;
   }
@@ -361,6 +422,7 @@ void TreePiece::startSmooth(// type of smoothing and parameters
   twSmooth = new BottomUpTreeWalk;
   sSmooth = new KNearestSmoothCompute(this, params, nSmooth, iLowhFix,
 				      dfBall2OverSoft2);
+  sSmooth->bRecordRefs = bSmoothReuse;
       
   initBucketsSmooth(sSmooth);
 
@@ -388,6 +450,7 @@ void TreePiece::startSmooth(// type of smoothing and parameters
 template <class Tsmooth>
 void TreePiece::initBucketsSmooth(Tsmooth tSmooth) {
   tSmooth->nActive = 0;
+  smoothBucketActive.assign(numBuckets, 0);
   for (unsigned int j=0; j<numBuckets; ++j) {
     GenericTreeNode* node = bucketList[j];
 
@@ -398,6 +461,7 @@ void TreePiece::initBucketsSmooth(Tsmooth tSmooth) {
     for(int i = node->firstParticle; i <= node->lastParticle; ++i) {
 	if(tSmooth->params->isSmoothActive(&myParticles[i])) {
 	    tSmooth->nActive++;
+	    smoothBucketActive[j]++;
 	    tSmooth->params->initSmoothParticle(&myParticles[i]);
 	    // node->boundingBox.grow(myParticles[i].position);
 	    }
@@ -428,12 +492,13 @@ void TreePiece::nextBucketSmooth(dummyMsg *msg){
   int currentBucket = sSmoothState->currentBucket;
   
   // smooths are faster than gravity, and they need cache messages to
-  // get through.  Therefore yield after every bucket.
+  // get through.  Therefore yield after every bucket with work.
   while(i<1 && currentBucket<numBuckets){
+    if(smoothBucketActive[currentBucket])
+      i++;
     smoothNextBucket();
     currentBucket++;
     sSmoothState->currentBucket++;
-    i++;
   }
 
   if (currentBucket<numBuckets) {	// Queue up the next set
@@ -450,14 +515,10 @@ void KNearestSmoothCompute::initSmoothPrioQueue(int iBucket, State *state)
   // state is passed in to function now. 
   NearNeighborState *nstate = (NearNeighborState *)state;
   
-  int bucketActive = 0;
-  for(int j = myNode->firstParticle; j <= myNode->lastParticle; ++j) {
-      if(params->isSmoothActive(&tp->myParticles[j]))
-	  bucketActive++;
-      }
-
-  if(!bucketActive) // No particles in this bucket are active.
+  if(!tp->smoothBucketActive[iBucket]) // No particles in this bucket are active.
       return;
+  if(bRecordRefs)
+      tp->startSmoothBucketRefs(iBucket, params->iType);
   
   //
   // Get nearest nSmooth particles in tree order
@@ -548,8 +609,19 @@ void KNearestSmoothCompute::initSmoothPrioQueue(int iBucket, State *state)
           }
       }
   
+  // Stage the bucket for bucketCompare()
+  if(nstate->dr2.size() < myNode->particleCount)
+      nstate->dr2.resize(myNode->particleCount);
   for(int j = myNode->firstParticle; j <= myNode->lastParticle; ++j) {
-      if(!params->isSmoothActive(&tp->myParticles[j]))
+      GravityParticle *p = &tp->myParticles[j];
+      nstate->xPos[j] = p->position.x;
+      nstate->yPos[j] = p->position.y;
+      nstate->zPos[j] = p->position.z;
+      nstate->bActive[j] = params->isSmoothActive(p);
+      }
+
+  for(int j = myNode->firstParticle; j <= myNode->lastParticle; ++j) {
+      if(!nstate->bActive[j])
 	  continue;
       GravityParticle *p = &tp->myParticles[j];
       bndSmoothAct.grow(p->position);
@@ -599,14 +671,34 @@ void KNearestSmoothCompute::initSmoothPrioQueue(int iBucket, State *state)
       }
 #endif
       //
-      // For FastGas, we have a limit on the size of the search ball.
+      // Verlet skin: the nSmooth neighbors found at the last search
+      // have each moved no more than dSkinDrift since, so they are
+      // within fSkinBall + 2*dSkinDrift.
       //
-      if(params->bUseBallMax && p->isGas() && p->fBallMax() > 0.0
-         && pqNew.fKey > p->fBallMax()*p->fBallMax())
-          pqNew.fKey = p->fBallMax()*p->fBallMax();
-      
-      if(iLowhFix && pqNew.fKey < dfBall2OverSoft2*p->soft*p->soft)
-          pqNew.fKey = dfBall2OverSoft2*p->soft*p->soft;
+      if(params->dSkinDrift >= 0.0 && p->isGas()
+         && p->fSkinBall() > 0.0
+         && 2.0*params->dSkinDrift <= dSmoothSkin*p->fSkinBall()) {
+          double rSkin = p->fSkinBall() + 2.0*params->dSkinDrift;
+          if(pqNew.fKey > rSkin*rSkin)
+              pqNew.fKey = rSkin*rSkin;
+          }
+      //
+      // Predict the new fBall from the compression since the last
+      // search.  This is not a bound: particles that come up short
+      // are searched again with fKeyRetry by retryShort().
+      //
+      double fKeyRetry = 0.0;
+      if(params->dBallPredict > 0.0 && p->isGas() && p->fBall > 0.0) {
+          double dFac = 1.0 + p->divv()*RungToDt(params->dDeltaPredict,
+                                                 p->rung)/3.0;
+          double rPred = params->dBallPredict*dFac*p->fBall;
+          if(dFac > 0.0 && pqNew.fKey > rPred*rPred) {
+              fKeyRetry = limitKey(p, pqNew.fKey);
+              pqNew.fKey = rPred*rPred;
+              }
+          }
+      pqNew.fKey = limitKey(p, pqNew.fKey);
+      nstate->fKeyRetry[j] = (fKeyRetry > pqNew.fKey) ? fKeyRetry : 0.0;
 
       if(pqNew.fKey > dKeyMaxBucket)
 	  dKeyMaxBucket = pqNew.fKey;
@@ -619,19 +711,14 @@ void KNearestSmoothCompute::initSmoothPrioQueue(int iBucket, State *state)
   myNode->fKeyMax = sqrt(dKeyMaxBucket);
   }
 
-void TreePiece::smoothBucketComputation() {
+/// @brief Walk the tree for the neighbors of bucket currentBucket.
+void TreePiece::smoothBucketComputation(int currentBucket) {
   twSmooth->init(sSmooth, this);
-  int currentBucket = sSmoothState->currentBucket;
   GenericTreeNode *myNode = bucketList[currentBucket];
   sSmooth->init(myNode, activeRung, optSmooth);
-  int bucketActive = 0;
-  for(int j = myNode->firstParticle; j <= myNode->lastParticle; ++j) {
-      if(sSmooth->params->isSmoothActive(&myParticles[j]))
-	  bucketActive += 1;
-      }
 
   // start the tree walk from the tree built in the cache
-  if (bucketActive) {
+  if (smoothBucketActive[currentBucket]) {
     for(int cr = 0; cr < numChunks; cr++){
       GenericTreeNode *chunkRoot = dm->chunkRootToNode(prefetchRoots[cr]);
       if(!chunkRoot){
@@ -653,13 +740,75 @@ void TreePiece::smoothBucketComputation() {
   sSmoothState->counterArrays[0][currentBucket]--;
 } 
 
+/// @brief Apply the FastGas (fBallMax) and iLowhFix limits to an
+/// initial search radius^2.
+double KNearestSmoothCompute::limitKey(GravityParticle *p, double fKey)
+{
+    //
+    // For FastGas, we have a limit on the size of the search ball.
+    //
+    if(params->bUseBallMax && p->isGas() && p->fBallMax() > 0.0
+       && fKey > p->fBallMax()*p->fBallMax())
+        fKey = p->fBallMax()*p->fBallMax();
+
+    if(iLowhFix && fKey < dfBall2OverSoft2*p->soft*p->soft)
+        fKey = dfBall2OverSoft2*p->soft*p->soft;
+    return fKey;
+}
+
+/// @brief Search again for the particles of iBucket whose predicted
+/// ball held fewer than nSmooth neighbors.  The other particles of the
+/// bucket are made inactive for the walk so their queues are kept.
+/// @return true if a walk was started; the bucket is then finished by
+/// that walk.
+bool KNearestSmoothCompute::retryShort(int iBucket, NearNeighborState *nstate)
+{
+  GenericTreeNode *myNode = tp->bucketList[iBucket];
+  OrientedBox<double> bndRetry;
+  double dKeyMaxBucket = 0.0;
+  int nRetry = 0;
+  for(int j = myNode->firstParticle; j <= myNode->lastParticle; ++j) {
+      double fKeyRetry = nstate->fKeyRetry[j];
+      nstate->fKeyRetry[j] = 0.0;
+      nstate->bActive[j] = 0;
+      if(fKeyRetry == 0.0)
+	  continue;
+      CkVec<pqSmoothNode> &Q = nstate->Qs[j];
+      if(Q[0].p != NULL)   // all nSmooth found within the prediction
+	  continue;
+      Q.clear();
+      pqSmoothNode pqNew;
+      pqNew.fKey = fKeyRetry;
+      pqNew.p = NULL;
+      Q.push_back(pqNew);
+      nstate->bActive[j] = 1;
+      bndRetry.grow(tp->myParticles[j].position);
+      if(fKeyRetry > dKeyMaxBucket)
+	  dKeyMaxBucket = fKeyRetry;
+      nRetry++;
+      }
+  if(nRetry == 0)
+      return false;
+
+  myNode->centerSm = bndRetry.center();
+  myNode->sizeSm = .5*(bndRetry.size()).length();
+  myNode->fKeyMax = sqrt(dKeyMaxBucket);
+  // The buckets of both walks would be recorded: don't replay them.
+  if(bRecordRefs)
+      tp->startSmoothBucketRefs(iBucket, -1);
+  nstate->counterArrays[0][iBucket] = 1;
+  tp->smoothBucketComputation(iBucket);
+  nstate->finishBucketSmooth(iBucket, tp);
+  return true;
+}
+
 void TreePiece::smoothNextBucket() {
   int currentBucket = sSmoothState->currentBucket;
   if(currentBucket >= numBuckets)
     return;
   ((KNearestSmoothCompute *)sSmooth)->initSmoothPrioQueue(currentBucket,
 							  sSmoothState);
-  smoothBucketComputation();
+  smoothBucketComputation(currentBucket);
   ((NearNeighborState *)sSmoothState)->finishBucketSmooth(currentBucket, this);
 }
 
@@ -667,7 +816,11 @@ void NearNeighborState::finishBucketSmooth(int iBucket, TreePiece *tp) {
   GenericTreeNode *node = tp->bucketList[iBucket];
 
   if(counterArrays[0][iBucket] == 0) {
-    tp->sSmooth->walkDone(this);
+    if(tp->smoothBucketActive[iBucket]) {
+	if(((KNearestSmoothCompute *)tp->sSmooth)->retryShort(iBucket, this))
+	    return;
+	tp->sSmooth->walkDone(this);
+	}
     if(verbosity>4)
 	CkPrintf("[%d] TreePiece %d finished smooth with bucket %d\n",CkMyPe(),
 		 tp->thisIndex,iBucket);
@@ -679,7 +832,7 @@ void NearNeighborState::finishBucketSmooth(int iBucket, TreePiece *tp) {
 #endif
       tp->nNodeCacheEntries = cacheNode.ckLocalBranch()->getCache()->size();
       tp->nPartCacheEntries = cacheSmoothPart.ckLocalBranch()->getCache()->size();
-      cacheSmoothPart[CkMyPe()].finishedChunk(0, 0);
+      smoothCacheFinishedChunk(0);
 #ifdef CHECK_WALK_COMPLETIONS
       CkPrintf("[%d] markWalkDone NearNeighborState\n", tp->getIndex());
 #endif
@@ -754,6 +907,9 @@ void KNearestSmoothCompute::walkDone(State *state) {
 	  }
       // The following assert() is not valid with the FastGas optimization.
       // CkAssert(nCnt >= nSmooth);
+      // Only an unlimited radius bounds the next search.
+      if(params->dSkinDrift >= 0.0 && p->isGas())
+	  p->fSkinBall() = (nCnt >= nSmooth) ? h : 0.0;
       // Limit fBall growth to help stability and inverse neighbor finding.
       if(!(iLowhFix && h*h <= dfBall2OverSoft2*p->soft*p->soft)
 	 && params->bUseBallMax && p->isGas() && p->fBallMax() > 0.0
@@ -766,8 +922,12 @@ void KNearestSmoothCompute::walkDone(State *state) {
 	      std::pop_heap(&(Q[0]) + 0, &(Q[0]) + nCnt);
 	      nCnt--;
 	      }
+	  if(params->dSkinDrift >= 0.0)
+	      p->fSkinBall() = 0.0;
 	  }
       p->fBall = h;
+      if(bRecordRefs)
+	  tp->setSmoothRefBall(i, h);
       params->fcnSmooth(p, nCnt, &(Q[0]));
       Q.clear();
       }
@@ -946,11 +1106,13 @@ void TreePiece::nextBucketReSmooth(dummyMsg *msg){
   unsigned int i=0;
   int currentBucket = sSmoothState->currentBucket;
   
+  // Buckets without active particles don't count towards the yield.
   while(i<_yieldPeriod && currentBucket<numBuckets){
+    if(smoothBucketActive[currentBucket])
+      i++;
     reSmoothNextBucket();
     currentBucket++;
     sSmoothState->currentBucket++;
-    i++;
   }
 
   if (currentBucket<numBuckets) {	// Queue up the next set
@@ -970,6 +1132,12 @@ void TreePiece::reSmoothNextBucket() {
   OrientedBox<double> bndSmoothAct; // bounding box for smoothActive particles
   double dKeyMaxBucket = 0.0;
   int bucketActive = 0;
+  if(smoothBucketActive[currentBucket] == 0) {
+      // Nothing to walk for
+      sSmoothState->counterArrays[0][currentBucket]--;
+      ((ReNearNeighborState *)sSmoothState)->finishBucketSmooth(currentBucket, this);
+      return;
+      }
   for(int j = myNode->firstParticle; j <= myNode->lastParticle; ++j) {
       if(!sSmooth->params->isSmoothActive(&myParticles[j]))
         continue;
@@ -983,14 +1151,100 @@ void TreePiece::reSmoothNextBucket() {
     myNode->sizeSm = .5*(bndSmoothAct.size()).length();
     myNode->fKeyMax = dKeyMaxBucket;
   }
-  smoothBucketComputation();
+  if(bSmoothReuse && bucketActive != 0 && smoothRefsUsable(currentBucket))
+      smoothBucketReplay();
+  else
+      smoothBucketComputation(currentBucket);
   ((ReNearNeighborState *)sSmoothState)->finishBucketSmooth(currentBucket, this);
 }
 
+/// @brief Start recording the buckets visited by a k nearest neighbor
+/// walk for iBucket, discarding those of a previous walk.
+void TreePiece::startSmoothBucketRefs(int iBucket, int iType) {
+  if(smoothBucketRefs.size() != numBuckets)
+      smoothBucketRefs.resize(numBuckets);
+  if(smoothRefBall.size() != myNumParticles+2)
+      smoothRefBall.assign(myNumParticles+2, 0.0);
+  smoothBucketRefs[iBucket].iType = iType;
+  smoothBucketRefs[iBucket].refs.clear();
+  GenericTreeNode *node = bucketList[iBucket];
+  for(int j = node->firstParticle; j <= node->lastParticle; ++j)
+      smoothRefBall[j] = 0.0;
+}
+
+void TreePiece::recordSmoothBucket(int iBucket, const SmoothBucketRef &ref) {
+  smoothBucketRefs[iBucket].refs.push_back(ref);
+}
+
+void TreePiece::setSmoothRefBall(int iPart, double h) {
+  smoothRefBall[iPart] = h;
+}
+
+/// @brief Can the ReSmooth of iBucket visit the buckets recorded by the
+/// last k nearest neighbor walk?  This requires the same tree and
+/// particle type, and that no active particle's ball has grown beyond
+/// the radius it was searched with.
+bool TreePiece::smoothRefsUsable(int iBucket) {
+  if(smoothBucketRefs.size() != numBuckets
+     || smoothRefBall.size() != myNumParticles+2)
+      return false;
+  if(smoothBucketRefs[iBucket].iType != sSmooth->params->iType)
+      return false;
+  GenericTreeNode *myNode = bucketList[iBucket];
+  for(int j = myNode->firstParticle; j <= myNode->lastParticle; ++j) {
+      if(!sSmooth->params->isSmoothActive(&myParticles[j]))
+	  continue;
+      if(smoothRefBall[j] == 0.0 || myParticles[j].fBall > smoothRefBall[j])
+	  return false;
+      }
+  return true;
+}
+
+/// @brief ReSmooth the current bucket over the buckets recorded by the
+/// preceding neighbor search.  Local particles are used directly and
+/// remote ones are requested from the cache as the tree walk would.
+void TreePiece::smoothBucketReplay() {
+  int currentBucket = sSmoothState->currentBucket;
+  GenericTreeNode *myNode = bucketList[currentBucket];
+  sSmooth->init(myNode, activeRung, optSmooth);
+  const int iType = sSmooth->params->iType;
+  double rBucket = myNode->sizeSm + myNode->fKeyMax;
+  // Same slop as ReSmoothCompute::bucketCompare()
+  double rBucket2 = rBucket*rBucket*(1.+1e-7);
+
+  std::vector<SmoothBucketRef> &refs = smoothBucketRefs[currentBucket].refs;
+  for(int iRef = 0; iRef < refs.size(); iRef++) {
+      SmoothBucketRef &ref = refs[iRef];
+      Vector3D<cosmoType> offset = decodeOffset(ref.reqID);
+      if(!intersect(ref.boundingBox, myNode->centerSm - offset, rBucket2))
+	  continue;
+      GravityParticle *part = ref.particles;
+      if(part == NULL) {
+	  part = requestSmoothParticles(ref.key, ref.chunk, ref.remoteIndex,
+					ref.firstParticle, ref.lastParticle,
+					ref.reqID, smoothAwi, myNode);
+	  if(part == NULL) {
+	      // Missed cache; record this
+	      sSmoothState->counterArrays[0][currentBucket]
+		  += ref.lastParticle - ref.firstParticle + 1;
+	      continue;
+	      }
+	  }
+      for(int i = 0; i <= ref.lastParticle - ref.firstParticle; i++) {
+	  if(!TYPETest(&part[i], iType))
+	      continue;
+	  sSmooth->bucketCompare(this, &part[i], myNode, myParticles, offset,
+				 sSmoothState);
+	  }
+      }
+  sSmoothState->counterArrays[0][currentBucket]--;
+}
+
 void ReNearNeighborState::finishBucketSmooth(int iBucket, TreePiece *tp) {
   GenericTreeNode *node = tp->bucketList[iBucket];
 
   if(counterArrays[0][iBucket] == 0) {
+    if(tp->smoothBucketActive[iBucket])
       tp->sSmooth->walkDone(this);
     nParticlesPending -= node->particleCount;
   if(verbosity>4)
@@ -1001,7 +1255,7 @@ void ReNearNeighborState::finishBucketSmooth(int iBucket, TreePiece *tp) {
 #ifdef CACHE_MEM_STATS
       tp->memWithCache = CmiMemoryUsage()/(1024*1024);
 #endif
-      cacheSmoothPart[CkMyPe()].finishedChunk(0, 0);
+      smoothCacheFinishedChunk(0);
 #ifdef CHECK_WALK_COMPLETIONS
       CkPrintf("[%d] markWalkDone ReNearNeighborState\n", tp->getIndex());
 #endif
@@ -1178,11 +1432,13 @@ void TreePiece::nextBucketMarkSmooth(dummyMsg *msg){
   unsigned int i=0;
   int currentBucket = sSmoothState->currentBucket;
   
+  // Buckets without active particles don't count towards the yield.
   while(i<_yieldPeriod && currentBucket<numBuckets){
+    if(smoothBucketActive[currentBucket])
+      i++;
     markSmoothNextBucket();
     currentBucket++;
     sSmoothState->currentBucket++;
-    i++;
   }
 
   if (currentBucket<numBuckets) {	// Queue up the next set
@@ -1196,7 +1452,7 @@ void TreePiece::markSmoothNextBucket() {
   int currentBucket = sSmoothState->currentBucket;
   if(currentBucket >= numBuckets)
     return;
-  smoothBucketComputation();
+  smoothBucketComputation(currentBucket);
   ((MarkNeighborState *)sSmoothState)->finishBucketSmooth(currentBucket, this);
 }
 
@@ -1214,7 +1470,7 @@ void MarkNeighborState::finishBucketSmooth(int iBucket, TreePiece *tp) {
 #ifdef CACHE_MEM_STATS
       tp->memWithCache = CmiMemoryUsage()/(1024*1024);
 #endif
-      cacheSmoothPart[CkMyPe()].finishedChunk(0, 0);
+      smoothCacheFinishedChunk(0);
 #ifdef CHECK_WALK_COMPLETIONS
       CkPrintf("[%d] markWalkDone ReNearNeighborState\n", tp->getIndex());
 #endif
@@ -1233,6 +1489,269 @@ void MarkSmoothCompute::walkDone(State *state) {
     // Nothing to do
 }
 
+// From here down are "BallSmooth" methods: a fixed radius gather
+// with no priority queue.
+
+double SmoothParams::fBallQuery(GravityParticle *p)
+{
+    return p->fBall;
+}
+
+// called after constructor, so tp should be set
+State *BallSmoothCompute::getNewState(int nBucket){
+  BallNeighborState *state = new BallNeighborState(tp->myNumParticles+2);
+  state->counterArrays[0] = new int [nBucket];
+  state->counterArrays[1] = 0;
+  for (int j = 0; j < nBucket; ++j) {
+    state->counterArrays[0][j] = 1;	// so we know that the local
+					// walk is not finished.
+    }
+  state->started = true;
+  CkAssert(tp->myTreeParticles >= 0);
+  state->nParticlesPending = tp->myTreeParticles;
+  state->currentBucket = 0;
+  state->bWalkDonePending = 0;
+  return state;
+}
+
+/**
+ * Opening criterion for the BallSmooth walk.
+ * Return true if we must open the node.
+ */
+int BallSmoothCompute::openCriterion(TreePiece *ownerTP, 
+				  GenericTreeNode *node, ///< Node to test
+				  int reqID, State *state) {
+    GenericTreeNode *myNode = (GenericTreeNode *) computeEntity;
+    GravityParticle *particles = ownerTP->getParticles();
+    Vector3D<cosmoType> offset = ownerTP->decodeOffset(reqID);
+    double *fBall2 = ((BallNeighborState *)state)->fBall2;
+    
+    double rBucket = myNode->sizeSm + myNode->fKeyMax;
+    if(!intersect(node->boundingBox, myNode->centerSm - offset,
+		  rBucket*rBucket))
+	return 0;
+
+    for(int j = myNode->firstParticle; j <= myNode->lastParticle; ++j) {
+	if(fBall2[j] < 0.0)
+	    continue;
+	if(intersect(node->boundingBox, particles[j].position - offset,
+		     fBall2[j])) {
+	   return 1;
+	   }
+	}
+    return 0;
+}
+
+/**
+ * Add a given particle to the neighbor lists of the bucket particles
+ * whose ball contains it.
+ */
+void BallSmoothCompute::bucketCompare(TreePiece *ownerTP,
+                                  GravityParticle *p,  ///< Particle to test
+                                  GenericTreeNode *node, ///< bucket
+                                  GravityParticle *particles, ///< local
+                                                              /// particle data
+                                  Vector3D<double> offset,  ///< periodic offset
+                                  State *state
+				  ) 
+{
+    BallNeighborState *bstate = (BallNeighborState *)state;
+    Vector3D<double> rp = offset + p->position;
+
+    Vector3D<double> drBucket = node->centerSm - rp;
+    if(sqr(node->sizeSm + node->fKeyMax) < drBucket.lengthSquared())
+	return;		// particle is outside all balls
+
+    for(int j = node->firstParticle; j <= node->lastParticle; ++j) {
+	Vector3D<double> dr = particles[j].position - rp;
+	double dr2 = dr.lengthSquared();
+	if(dr2 > bstate->fBall2[j])  // also skips inactive and full lists
+	    continue;
+	CkVec<pqSmoothNode> &Q = bstate->Qs[j];
+	pqSmoothNode pqNew;
+	pqNew.fKey = dr2;
+	pqNew.dx = dr;
+	pqNew.p = p;
+	Q.push_back(pqNew);
+	if(nBallMax > 0 && (int) Q.size() >= nBallMax)
+	    bstate->fBall2[j] = -1.0;  // Done: stop searching for j
+	}
+    }
+
+/*
+ * Process particles received from missed Cache request
+ */
+void BallSmoothCompute::recvdParticlesFull(GravityParticle *part,
+				   int num, int chunk,int reqID, State *state,
+				   TreePiece *tp, Tree::NodeKey &remoteBucket){
+
+  Vector3D<cosmoType> offset = tp->decodeOffset(reqID);
+  int reqIDlist = decodeReqID(reqID);
+  CkAssert(num > 0);
+  state->counterArrays[0][reqIDlist] -= num;
+
+  GenericTreeNode* reqnode = tp->bucketList[reqIDlist];
+
+  for(int i=0;i<num;i++){
+      if(!TYPETest(&part[i], params->iType))
+	  continue;
+      bucketCompare(tp, &part[i], reqnode, tp->myParticles, offset, state);
+      }
+  ((BallNeighborState *)state)->finishBucketSmooth(reqIDlist, tp);
+}
+
+void BallSmoothCompute::nodeRecvdEvent(TreePiece *owner, int chunk,
+				      State *state, int reqIDlist){
+  state->counterArrays[0][reqIDlist]--;
+  ((BallNeighborState *)state)->finishBucketSmooth(reqIDlist, owner);
+}
+
+/// @brief execute SmoothParams::fcnSmooth() for all particles in the
+/// bucket with their unsorted neighbor lists.  fBall is not changed.
+void BallSmoothCompute::walkDone(State *state) {
+  GenericTreeNode *node = (GenericTreeNode *) computeEntity;
+  GravityParticle *part = node->particlePointer;
+  BallNeighborState *bstate = (BallNeighborState *)state;
+
+  for(int i = node->firstParticle; i <= node->lastParticle; i++) {
+      bstate->fBall2[i] = -1.0;
+      if(!params->isSmoothActive(&part[i-node->firstParticle]))
+	  continue;
+      CkVec<pqSmoothNode> *Q = &bstate->Qs[i];
+      pqSmoothNode *NN = NULL;
+      int nCnt = Q->size();
+      if(nCnt > 0)
+          NN = &((*Q)[0]);
+      params->fcnSmooth(&part[i-node->firstParticle], nCnt, NN);
+      Q->clear();
+      }
+}
+
+// Start ballsmooth walk
+
+void TreePiece::startBallSmooth(SmoothParams* params,
+				       const CkCallback& cb) {
+
+  cbSmooth = cb;
+  activeRung = params->activeRung;
+
+  setupSmooth();
+  if (myNumParticles == 0) {
+      markSmoothWalkDone();
+      return;
+      }
+
+  // Create objects that are reused by all buckets
+  twSmooth = new TopDownTreeWalk;
+  sSmooth = new BallSmoothCompute(this, params);
+
+  initBucketsSmooth(sSmooth);
+
+  // creates and initializes ballneighborstate object
+  sSmoothState = sSmooth->getNewState(numBuckets);
+  optSmooth = new SmoothOpt;
+  processReqSmoothParticles();
+
+  addActiveWalk(smoothAwi, twSmooth,sSmooth,optSmooth,sSmoothState);
+#ifdef CHECK_WALK_COMPLETIONS
+  CkPrintf("[%d] addActiveWalk ballSmooth (%d)\n", thisIndex, activeWalks.length());
+#endif
+
+  thisProxy[thisIndex].calculateBallSmoothLocal();
+}
+
+// Start the smoothing
+
+void TreePiece::calculateBallSmoothLocal() {
+    dummyMsg *msg = new (8*sizeof(int)) dummyMsg;
+    // Give smooths higher priority than gravity
+    *((int *)CkPriorityPtr(msg)) = thisIndex + 1;
+    CkSetQueueing(msg,CK_QUEUEING_IFIFO);
+    thisProxy[thisIndex].nextBucketBallSmooth(msg);
+    }
+
+//
+// Do the next set of buckets
+//
+void TreePiece::nextBucketBallSmooth(dummyMsg *msg){
+  unsigned int i=0;
+  int currentBucket = sSmoothState->currentBucket;
+  
+  // Buckets without active particles don't count towards the yield.
+  while(i<_yieldPeriod && currentBucket<numBuckets){
+    if(smoothBucketActive[currentBucket])
+      i++;
+    ballSmoothNextBucket();
+    currentBucket++;
+    sSmoothState->currentBucket++;
+  }
+
+  if (currentBucket<numBuckets) {	// Queue up the next set
+    thisProxy[thisIndex].nextBucketBallSmooth(msg);
+  } else {
+    delete msg;
+  }
+}
+
+void TreePiece::ballSmoothNextBucket() {
+  int currentBucket = sSmoothState->currentBucket;
+  if(currentBucket >= numBuckets)
+      return;
+
+  GenericTreeNode *myNode = bucketList[currentBucket];
+  BallNeighborState *bstate = (BallNeighborState *)sSmoothState;
+  if(smoothBucketActive[currentBucket] == 0) {
+      // Nothing to walk for
+      sSmoothState->counterArrays[0][currentBucket]--;
+      bstate->finishBucketSmooth(currentBucket, this);
+      return;
+      }
+  // set bucket search quantities, and the radii once per walk
+  OrientedBox<double> bndSmoothAct; // bounding box for smoothActive particles
+  double dBallMaxBucket = 0.0;
+  for(int j = myNode->firstParticle; j <= myNode->lastParticle; ++j) {
+      if(!sSmooth->params->isSmoothActive(&myParticles[j]))
+        continue;
+      double r = sSmooth->params->fBallQuery(&myParticles[j]);
+      bstate->fBall2[j] = r*r;
+      bndSmoothAct.grow(myParticles[j].position);
+      if(r > dBallMaxBucket)
+	  dBallMaxBucket = r;
+      }
+  myNode->centerSm = bndSmoothAct.center();
+  myNode->sizeSm = .5*(bndSmoothAct.size()).length();
+  myNode->fKeyMax = dBallMaxBucket;
+  smoothBucketComputation(currentBucket);
+  bstate->finishBucketSmooth(currentBucket, this);
+}
+
+void BallNeighborState::finishBucketSmooth(int iBucket, TreePiece *tp) {
+  GenericTreeNode *node = tp->bucketList[iBucket];
+
+  if(counterArrays[0][iBucket] == 0) {
+    if(tp->smoothBucketActive[iBucket])
+      tp->sSmooth->walkDone(this);
+    nParticlesPending -= node->particleCount;
+  if(verbosity>4)
+	CkPrintf("[%d] TreePiece %d finished ballsmooth with bucket %d, %d Pending\n",CkMyPe(),
+		 tp->thisIndex,iBucket,nParticlesPending);
+    if(started && nParticlesPending == 0) {
+      started = false;
+#ifdef CACHE_MEM_STATS
+      tp->memWithCache = CmiMemoryUsage()/(1024*1024);
+#endif
+      smoothCacheFinishedChunk(0);
+#ifdef CHECK_WALK_COMPLETIONS
+      CkPrintf("[%d] markWalkDone BallNeighborState\n", tp->getIndex());
+#endif
+      tp->markSmoothWalkDone();
+      if(verbosity > 1)
+	ckerr << "TreePiece " << tp->thisIndex << ": My particles are done"
+	     << endl;
+    }
+  }
+}
+
 /*
  * Functions from PKDGRAV
  */
@@ -1292,3 +1811,99 @@ void DensitySmoothParams::fcnSmooth(GravityParticle *p,int nSmooth,
 		q->fDensity += rs*p->mass;
 		}
 	}
+
+// SPH kernels
+
+double sphKernelTable[SPH_KERNEL_N][2][SPH_KERNEL_TABLE_SIZE+2];
+
+/// @brief Tabulate kernel K for KernelTable<K>.
+template <class K> static void fillSphKernelTable()
+{
+    for(int i = 0; i <= SPH_KERNEL_TABLE_SIZE + 1; i++) {
+	// Clamp the extra entry to the edge of the kernel.
+	double ar2 = std::min(4.0*i/SPH_KERNEL_TABLE_SIZE, 4.0);
+	sphKernelTable[K::iType][0][i] = K::kernel(ar2);
+	sphKernelTable[K::iType][1][i] = K::dkernel(ar2);
+	}
+    }
+
+/// @brief Fill the kernel tables once per node.
+void initSphKernelTables()
+{
+    fillSphKernelTable<KernelM4>();
+    fillSphKernelTable<KernelM6>();
+    // Interpolation near the center needs the limit rather than the
+    // 0 that dkernel() returns for the self term.
+    sphKernelTable[SPH_KERNEL_M6][1][0] = KernelM6::dkernelCenter();
+    fillSphKernelTable<KernelWendlandC2>();
+    fillSphKernelTable<KernelWendlandC4>();
+    fillSphKernelTable<KernelWendlandC6>();
+    }
+
+/// @brief kernelListPolicy() for Wendland kernel K, which smooths
+/// with M4 for nSmooth < 32 as KERNEL() does.
+template <class M4, class K>
+static void kernelListWendland(const double *ar2, double *rs, double *rs1,
+			       int n, int nSmooth)
+{
+    if(nSmooth < 32)
+	kernelListPolicy<M4, K>(ar2, rs, rs1, n, nSmooth);
+    else
+	kernelListPolicy<K, K>(ar2, rs, rs1, n, nSmooth);
+    }
+
+/// @brief KERNEL() and DKERNEL() over a list of neighbors.  The kernel
+/// is selected once for the list, so the loop over it vectorizes.
+/// @param ar2 (|dx|/h)^2 of each neighbor, 0 for the particle itself
+/// @param rs set to KERNEL(ar2[i], nSmooth)
+/// @param rs1 set to DKERNEL(ar2[i])
+/// @param n number of neighbors in the list
+/// @param nSmooth number of neighbors of the particle
+void kernelList(const double *ar2, double *rs, double *rs1, int n,
+		int nSmooth)
+{
+    if(bSphKernelTable) {
+	typedef KernelTable<KernelM4> M4;
+	switch(iSphKernel) {
+	case SPH_KERNEL_M6:
+	    kernelListPolicy<KernelTable<KernelM6>, KernelTable<KernelM6> >
+		(ar2, rs, rs1, n, nSmooth);
+	    return;
+	case SPH_KERNEL_WENDLAND_C2:
+	    kernelListWendland<M4, KernelTable<KernelWendlandC2> >
+		(ar2, rs, rs1, n, nSmooth);
+	    return;
+	case SPH_KERNEL_WENDLAND_C4:
+	    kernelListWendland<M4, KernelTable<KernelWendlandC4> >
+		(ar2, rs, rs1, n, nSmooth);
+	    return;
+	case SPH_KERNEL_WENDLAND_C6:
+	    kernelListWendland<M4, KernelTable<KernelWendlandC6> >
+		(ar2, rs, rs1, n, nSmooth);
+	    return;
+	default:
+	    kernelListPolicy<M4, M4>(ar2, rs, rs1, n, nSmooth);
+	    return;
+	    }
+	}
+    switch(iSphKernel) {
+    case SPH_KERNEL_M6:
+	kernelListPolicy<KernelM6, KernelM6>(ar2, rs, rs1, n, nSmooth);
+	return;
+    case SPH_KERNEL_WENDLAND_C2:
+	kernelListWendland<KernelM4, KernelWendlandC2>(ar2, rs, rs1, n,
+							nSmooth);
+	return;
+    case SPH_KERNEL_WENDLAND_C4:
+	kernelListWendland<KernelM4, KernelWendlandC4>(ar2, rs, rs1, n,
+							nSmooth);
+	return;
+    case SPH_KERNEL_WENDLAND_C6:
+	kernelListWendland<KernelM4, KernelWendlandC6>(ar2, rs, rs1, n,
+							nSmooth);
+	return;
+    default:
+	kernelListPolicy<KernelM4, KernelM4>(ar2, rs, rs1, n, nSmooth);
+	return;
+	}
+    }
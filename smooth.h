@@ -27,28 +27,45 @@ class pqSmoothNode
 class NearNeighborState: public State {
 public:
     CkVec<pqSmoothNode> *Qs; 
+    /// Positions of the bucket particles in structure of arrays form,
+    /// indexed like Qs, so distances to a bucket can be vectorized.
+    double *xPos;
+    double *yPos;
+    double *zPos;
+    /// Cached isSmoothActive() of the bucket particles
+    char *bActive;
+    /// Initial key to search again with if the predicted fBall comes
+    /// up short; 0 if there was no prediction.
+    double *fKeyRetry;
+    /// Scratch distances^2 used by bucketCompare()
+    std::vector<double> dr2;
     int nParticlesPending;
     int mynParts; 
     bool started;
     
     NearNeighborState(int nParts, int nSmooth) {
         Qs = new CkVec<pqSmoothNode>[nParts+2];
+        xPos = new double[nParts+2];
+        yPos = new double[nParts+2];
+        zPos = new double[nParts+2];
+        bActive = new char[nParts+2]();
+        fKeyRetry = new double[nParts+2]();
 	mynParts = nParts; 
         }
 
     void finishBucketSmooth(int iBucket, TreePiece *tp);
     ~NearNeighborState() {
 	delete [] Qs; 
+	delete [] xPos;
+	delete [] yPos;
+	delete [] zPos;
+	delete [] bActive;
+	delete [] fKeyRetry;
         }
 };
 
 #include "smoothparams.h"
 
-// XXX so we can access the init function with the Cache unpack
-// method.
-
-extern SmoothParams *globalSmoothParams;
-
 /// Class to specify density smooth
 class DensitySmoothParams : public SmoothParams
 {
@@ -82,18 +99,36 @@ class SmoothCompute : public Compute
 
  public:
     SmoothParams *params;
+    /// Record the buckets visited for use by a following ReSmooth
+    bool bRecordRefs;
 
     SmoothCompute(TreePiece *_tp, SmoothParams *_params) : Compute(Smooth){
 	params = _params;
-	// XXX Assign to global pointer: not thread safe
-	globalSmoothParams = params;
+	bRecordRefs = false;
         tp = _tp;       // needed in getNewState()
 	params->tp = tp;
+	// Cached copies of remote particles are initialized with the
+	// parameters of the walk that requested them.  There is one
+	// entry type per TreePiece, so one smooth walk at a time.
+	CkAssert(tp->smoothParticleEntry.params == NULL);
+	tp->smoothParticleEntry.params = params;
 	}
     ~SmoothCompute() { //delete state;
       // delete params;
     }
 
+ protected:
+    /// @brief Free the parameters at the end of the walk.  The
+    /// cache entry type must not keep pointing at them.
+    void deleteParams() {
+	if(tp->smoothParticleEntry.params == params)
+	    tp->smoothParticleEntry.params = NULL;
+	delete params;
+	params = NULL;
+    }
+
+ public:
+
     virtual 
       void bucketCompare(TreePiece *tp,
 			 GravityParticle *p,  // Particle to test
@@ -112,6 +147,8 @@ class SmoothCompute : public Compute
 	       bool &didcomp, int awi);
     void reassoc(void *ce, int ar, Opt *o);    
     void nodeMissedEvent(int reqID, int chunk, State *state, TreePiece *tp);
+    void recordBucket(GenericTreeNode *node, GravityParticle *part,
+		      int chunk, int reqID);
     
 
 
@@ -136,7 +173,7 @@ public:
 	 dfBall2OverSoft2 = dfB2OS2;
          }
     ~KNearestSmoothCompute() { //delete state;
-	delete params;
+	deleteParams();
     }
 
     void bucketCompare(TreePiece *tp,
@@ -148,6 +185,8 @@ public:
 		       ) ;
 	    
     void initSmoothPrioQueue(int iBucket, State *state) ;
+    double limitKey(GravityParticle *p, double fKey);
+    bool retryShort(int iBucket, NearNeighborState *nstate);
     int openCriterion(TreePiece *ownerTP, GenericTreeNode *node, int reqID, State *state);
     void startNodeProcessEvent(State *state){ }
     void finishNodeProcessEvent(TreePiece *owner, State *state){ }
@@ -190,7 +229,7 @@ public:
     ReSmoothCompute(TreePiece *_tp, SmoothParams *_params) : SmoothCompute(_tp, _params){}
 
     ~ReSmoothCompute() { //delete state;
-	delete params;
+	deleteParams();
     }
 
     void bucketCompare(TreePiece *tp,
@@ -228,7 +267,7 @@ public:
     MarkSmoothCompute(TreePiece *_tp, SmoothParams *_params) : SmoothCompute(_tp, _params){}
 
     ~MarkSmoothCompute() { //delete state;
-	delete params;
+	deleteParams();
     }
 
     void bucketCompare(TreePiece *tp,
@@ -267,6 +306,73 @@ public:
     ~MarkNeighborState() {}
 };
 
+/// @brief Class for computation over all neighbors within a radius
+/// given by SmoothParams::fBallQuery().  Unlike the ReSmooth, the
+/// radius does not have to be fBall.
+class BallSmoothCompute : public SmoothCompute 
+{
+    /// Stop collecting for a particle with this many neighbors; 0
+    /// for no limit.
+    int nBallMax;
+
+public:
+    BallSmoothCompute(TreePiece *_tp, SmoothParams *_params)
+	: SmoothCompute(_tp, _params) {
+	nBallMax = _params->nBallQueryMax();
+	}
+
+    ~BallSmoothCompute() { //delete state;
+	deleteParams();
+    }
+
+    void bucketCompare(TreePiece *tp,
+		       GravityParticle *p,  // Particle to test
+		       GenericTreeNode *node, // bucket
+		       GravityParticle *particles, // local particle data
+		       Vector3D<double> offset,
+                       State *state
+		       ) ;
+	    
+    int openCriterion(TreePiece *ownerTP, GenericTreeNode *node, int reqID, State *state);
+    void startNodeProcessEvent(State *state){ }
+    void finishNodeProcessEvent(TreePiece *owner, State *state){ }
+    void nodeRecvdEvent(TreePiece *owner, int chunk, State *state, int bucket);
+    void recvdParticlesFull(GravityParticle *egp,int num,int chunk,
+			int reqID,State *state, TreePiece *tp,
+			Tree::NodeKey &remoteBucket);
+    void walkDone(State *state) ;
+
+    State *getNewState(int d1);
+    /// @brief default implementation
+    State *getNewState(int d1, int d2) {return 0;}
+    /// @brief default implementation
+    State *getNewState() {return 0;}
+    };
+
+/// Object to bookkeep a Bucket BallSmooth Walk.
+
+class BallNeighborState: public State {
+public:
+    /// Unsorted neighbor lists
+    CkVec<pqSmoothNode> *Qs;
+    /// Search radius^2 of each particle of the current buckets;
+    /// negative if the particle is inactive or its list is full.
+    double *fBall2;
+    int nParticlesPending;
+    bool started;
+    BallNeighborState(int nParts) {
+	Qs = new CkVec<pqSmoothNode>[nParts+2];
+	fBall2 = new double[nParts+2];
+	for(int j = 0; j < nParts+2; ++j)
+	    fBall2[j] = -1.0;
+	}
+    void finishBucketSmooth(int iBucket, TreePiece *tp);
+    ~BallNeighborState() {
+	delete [] Qs;
+	delete [] fBall2;
+	}
+};
+
 #include "Opt.h"
 
 /// @brief action optimization for the smooth walk.
@@ -317,68 +423,72 @@ double invH2(GravityParticle *p)
     return 4.0/(p->fBall*p->fBall);
     }
 
-/**
- * @brief kernelWendland is a scaled version of the C4 Wendland SPH kernel
- * 
- * This kernel is explained and defined in Dehnen & Aly (2012).  The kernel
- * is defined as:
- *  W(r) = (495/(32 pi H^3)) (1-r)^6 (1 + 6r + (35/3)r^2 )    for r < 1
- * for r = |dx|/H
- * And for us, H = 2*h_smooth
- * 
- * Also includes a correction for self-interactions. N.B. For small
- * neighbor counts this correction does not work well; therefore, we
- * revert to M4 smoothing for nSmooth < 32.
- * 
- * NOTE: this kernel should not be called for r > 1
- * @param ar2 = (|dx|/h)^2 = (2r)^2
- * @return (pi h^3) W
+/// @brief SPH kernels selectable with the iSPHKernel parameter.
+enum SphKernelType {
+    SPH_KERNEL_M4 = 0,          ///< M4 cubic spline
+    SPH_KERNEL_M6 = 1,          ///< M6 quintic spline
+    SPH_KERNEL_WENDLAND_C2 = 2, ///< Wendland C2
+    SPH_KERNEL_WENDLAND_C4 = 3, ///< Wendland C4
+    SPH_KERNEL_WENDLAND_C6 = 4, ///< Wendland C6
+    SPH_KERNEL_N
+};
+
+/// Default of iSPHKernel, chosen with configure --enable-sph-kernel
+#if WENDLAND == 1
+#define SPH_KERNEL_DEFAULT SPH_KERNEL_WENDLAND_C4
+#elif M6KERNEL == 1
+#define SPH_KERNEL_DEFAULT SPH_KERNEL_M6
+#elif M4KERNEL == 1
+#define SPH_KERNEL_DEFAULT SPH_KERNEL_M4
+#else
+    #error No available kernel selected.
+#endif //KERNEL
+
+/*
+ * Kernel policies.  Each provides, for ar2 = (|dx|/h)^2 <= 4:
+ *  kernel(ar2)     = (pi h^3) W
+ *  kernel0(nSmooth) = (pi h^3) W at the particle itself
+ *  dkernel(ar2)    = (pi h^5/|dx|^2) (dx.dot.gradW)
+ * The evaluations have no branches, so loops over neighbors that
+ * call them vectorize.
  */
-inline double kernelWendland(double ar2, int nSmooth)
-{    
-    double ak;
-    if (nSmooth < 32)
-    {
-        ak = 2.0 - sqrt(ar2);
-        if (ar2 < 1.0) ak = (1.0 - 0.75*ak*ar2);
-        else ak = 0.25*ak*ak*ak;
-        return ak;
-    }
-	if (ar2 <= 0) ak = (495/32./8.)*(1-0.01342*pow(nSmooth*0.01,-1.579));/* Dehnen & Aly 2012 correction */ 
-	else {								
-	    double au = sqrt(ar2*0.25);					
-	    ak = 1-au;							
-	    ak = ak*ak*ak;							
-	    ak = ak*ak;							
-	    ak = (495/32./8.)*ak*(1+6*au+(35/3.)*au*au); 
-	    }								
-    return ak;
-	}
+
+/* Standard M_4 Kernel */
 /**
- * @brief dkernelWendland returns a scaled gradient of Wendland SPH kernel
+ * @brief KernelM4 is a scaled version of the standard M4 cubic SPH kernel
  * 
- * This returns the gradient of the Wendland C4 Kernel (see Dehnen & Aly 2012),
- * scaled by a factor.  The gradient is defined by:
- *  gradW(r) = -(7*495/(3*32*2*pi*h^4)) r (1-r)^5 (1+5r) dxHat
- * where dxHat is the unit vector pointing between 2 particles
- * r = |dx|/2h
- * dx is the particle separation (vector)
- * 
- * @param ar2
- * @return (pi h^5/|dx|^2) (dx.dot.gradW)
+ * This returns a scaled version of the standard SPH kernel (W) of Monaghan 1992
+ * The kernel W(q) is defined as:
+ *  W(q) = (1/(pi h^3)) (1 - 1.5q^2 + 0.75q^3)       for 0 < q < 1
+ *  W(q) = (1/(4 pi h^3)) (2 - q)^3                  for 1 < q < 2
+ * for q = |dx|/h
+ * The kernel gradient gradW is defined as:
+ *  gradW(q) = (1/(pi h^5)) (-3 + 9q/4) dx            for 0 < q < 1
+ *  gradW(q) = -(1/(pi h^5)) (3/4) [(2-q)^2 /q] dx    for 1 < q < 2
  */
-inline double dkernelWendland(double ar2)
-{
-    double adk;
-    double _a2,au = sqrt(ar2*0.25);                     
-    adk = 1-au;                                         
-    _a2 = adk*adk;                                      
-    adk = (-495/32.*7./3./4.)*_a2*_a2*adk*(1+5*au);        
-    return adk;
+class KernelM4 {
+ public:
+    static const int iType = SPH_KERNEL_M4;
+    static inline double kernel(double ar2) {
+	// Both pieces are evaluated so the selection compiles to a blend.
+	double ak = 2.0 - sqrt(ar2);
+	double akInner = 1.0 - 0.75*ak*ar2;
+	double akOuter = 0.25*ak*ak*ak;
+	return (ar2 < 1.0) ? akInner : akOuter;
 	}
+    static inline double kernel0(int nSmooth) { return 1.0; }
+    static inline double dkernel(double ar2) {
+	double adk = sqrt(ar2);
+	double adkInner = -3 + 2.25*adk;
+	// adk >= 1 where the outer piece is used; the max() only keeps
+	// the unused evaluation at adk = 0 finite.
+	double adkOuter = -0.75*(2.0-adk)*(2.0-adk)/std::max(adk, 1.0);
+	return (ar2 < 1.0) ? adkInner : adkOuter;
+	}
+};
 
 /**
- * @brief kernelM6 returns a scaled version of the M6 quintic spline kernel.
+ * @brief KernelM6 is a scaled version of the M6 quintic spline kernel.
  * 
  * This kernel is outlined in e.g. Dehnen & Aly 2012.  The kernel is defined as:
  *      W(r) = A (1-r)^5   (for r < 2/3)
@@ -389,151 +499,231 @@ inline double dkernelWendland(double ar2)
  *      r = |dx|/H
  *      A = 3^7/(40 pi H^3))
  * And for us, H = 2*h_smooth
- * 
- * @param ar2 = (|dx|/h)^2 = (2r)^2
- * @return (pi h^3) W
- */
-inline double kernelM6(double ar2) {
-    double r = 0.5 * sqrt(ar2);
-    double w;
-    // Sanity checks
-    CkAssert(r >= 0.0);
-    CkAssert(r <= 1.0000001);
-    w = pow(1. - r, 5);
-    if (r < 2./3.) {
-        w += -6. * pow(2./3. - r, 5);
-        if (r < 1./3.) {
-            w += 15. * pow(1./3. - r, 5);
-        }
-    }
-    return 6.834375 * w;
-}
-
-/**
- * @brief dkernelM6 returns a scaled gradient of the M6 quintic spline kernel.
- * 
- * This kernel is outlined in e.g. Dehnen & Aly 2012.
- * Using the definitions:
- *      r = |dx|/H
- *      H = 2 * h
- * dkernelM6 returns a scalar equal to (pi h^5/|dx|^2) * (dx.dot.gradW), where
- * gradW is the gradient of the kernel W.
- * @param ar2 = (|dx|/h)^2 = (2r)^2
- * @return (pi h^5/|dx|^2) * (dx.dot.gradW)
  */
-inline double dkernelM6(double ar2) {
-    double r = 0.5 * sqrt(ar2);
-    double dw = 0.0;
-    // Sanity checks
-    CkAssert(r >= 0.0);
-    CkAssert(r <= 1.0000001);
-    dw = -5. *  pow(1. - r, 4);
-    if (r < 2./3.) {
-        dw += 30. * pow(2./3. - r, 4);
-        if (r < 1./3.) {
-            if (r == 0.) {
-                dw = 0.0;
-                r = 1.;
-            } else {
-                dw += -75. * pow(1./3. - r, 4);
-            }
-        }
-    }
-    dw /= r;
-    // Normalize by 3^7/(32*40)
-    dw *= 1.70859375;
-    return dw;
-}
+class KernelM6 {
+ public:
+    static const int iType = SPH_KERNEL_M6;
+    static inline double kernel(double ar2) {
+	double r = 0.5 * sqrt(ar2);
+	double a = 1. - r;
+	double b = std::max(2./3. - r, 0.0);
+	double c = std::max(1./3. - r, 0.0);
+	double a2 = a*a, b2 = b*b, c2 = c*c;
+	return 6.834375 * (a2*a2*a - 6.*b2*b2*b + 15.*c2*c2*c);
+	}
+    static inline double kernel0(int nSmooth) { return kernel(0.0); }
+    /// Limit of dkernel() at the center, where dkernel() returns 0:
+    /// dw/r -> -40/9.
+    static inline double dkernelCenter() { return -40./9.*1.70859375; }
+    static inline double dkernel(double ar2) {
+	double r = 0.5 * sqrt(ar2);
+	double a = 1. - r;
+	double b = std::max(2./3. - r, 0.0);
+	double c = std::max(1./3. - r, 0.0);
+	double a2 = a*a, b2 = b*b, c2 = c*c;
+	double dw = -5.*a2*a2 + 30.*b2*b2 - 75.*c2*c2;
+	// The gradient term is 0 at the center.
+	double rInv = (r > 0.0) ? 1.0/r : 0.0;
+	// Normalize by 3^7/(32*40)
+	return 1.70859375 * dw * rInv;
+	}
+};
 
-/* Standard M_4 Kernel */
 /**
- * @brief kernelM4 is a scaled version of the standard M4 cubic SPH kernel
+ * @brief Wendland C2, C4 and C6 kernels (Dehnen & Aly 2012)
  * 
- * This returns a scaled version of the standard SPH kernel (W) of Monaghan 1992
- * The kernel W(q) is defined as:
- *  W(q) = (1/(pi h^3)) (1 - 1.5q^2 + 0.75q^3)       for 0 < q < 1
- *  W(q) = (1/(4 pi h^3)) (2 - q)^3                  for 1 < q < 2
- * for q = |dx|/h
+ * The kernels are defined as:
+ *  C2: W(r) = (21/(2 pi H^3)) (1-r)^4 (1 + 4r)
+ *  C4: W(r) = (495/(32 pi H^3)) (1-r)^6 (1 + 6r + (35/3)r^2 )
+ *  C6: W(r) = (1365/(64 pi H^3)) (1-r)^8 (1 + 8r + 25r^2 + 32r^3)
+ * for r = |dx|/H < 1, and for us, H = 2*h_smooth
  * 
- * NOTE: This function returns a scaled version of W(q)
- * @param ar2 = q^2 = (|dx|/h)^2
- * @return (pi h^3) W
+ * kernel0() includes the correction for self-interactions of
+ * Dehnen & Aly 2012.  N.B. For small neighbor counts this correction
+ * does not work well; therefore, KERNEL() reverts to M4 smoothing
+ * for nSmooth < 32.
  */
-inline double kernelM4(double ar2)
+class KernelWendlandC2 {
+ public:
+    static const int iType = SPH_KERNEL_WENDLAND_C2;
+    static inline double kernel(double ar2) {
+	double au = sqrt(ar2*0.25);
+	double ak = 1-au;
+	ak = ak*ak;
+	return (21/16.)*ak*ak*(1+4*au);
+	}
+    static inline double kernel0(int nSmooth) {
+	return (21/16.)*(1-0.0294*pow(nSmooth*0.01,-0.977));
+	}
+    static inline double dkernel(double ar2) {
+	double au = sqrt(ar2*0.25);
+	double adk = 1-au;
+	return (-21/2.*20./32.)*adk*adk*adk;
+	}
+};
+
+class KernelWendlandC4 {
+ public:
+    static const int iType = SPH_KERNEL_WENDLAND_C4;
+    static inline double kernel(double ar2) {
+	double au = sqrt(ar2*0.25);
+	double ak = 1-au;
+	ak = ak*ak*ak;
+	ak = ak*ak;
+	return (495/32./8.)*ak*(1+6*au+(35/3.)*au*au);
+	}
+    static inline double kernel0(int nSmooth) {
+	return (495/32./8.)*(1-0.01342*pow(nSmooth*0.01,-1.579));
+	}
+    static inline double dkernel(double ar2) {
+	double au = sqrt(ar2*0.25);
+	double adk = 1-au;
+	double _a2 = adk*adk;
+	return (-495/32.*7./3./4.)*_a2*_a2*adk*(1+5*au);
+	}
+};
+
+class KernelWendlandC6 {
+ public:
+    static const int iType = SPH_KERNEL_WENDLAND_C6;
+    static inline double kernel(double ar2) {
+	double au = sqrt(ar2*0.25);
+	double ak = 1-au;
+	ak = ak*ak;
+	ak = ak*ak;
+	return (1365/64./8.)*ak*ak*(1+au*(8+au*(25+32*au)));
+	}
+    static inline double kernel0(int nSmooth) {
+	return (1365/64./8.)*(1-0.0116*pow(nSmooth*0.01,-2.236));
+	}
+    static inline double dkernel(double ar2) {
+	double au = sqrt(ar2*0.25);
+	double adk = 1-au;
+	double _a2 = adk*adk;
+	_a2 = _a2*_a2;
+	return (-1365/64.*22./32.)*_a2*adk*adk*adk*(1+au*(7+16*au));
+	}
+};
+
+/// Number of intervals in ar2 = [0, 4] of the tabulated kernels
+#define SPH_KERNEL_TABLE_SIZE 1024
+
+/// Tabulated kernel() (index 0) and dkernel() (index 1) of each kernel
+extern double sphKernelTable[SPH_KERNEL_N][2][SPH_KERNEL_TABLE_SIZE+2];
+
+/// @brief Linear interpolation in a kernel table
+inline double sphKernelLookup(const double *table, double ar2)
 {
-    double ak;
-    ak = 2.0 - sqrt(ar2);
-    if (ar2 < 1.0) ak = (1.0 - 0.75*ak*ar2);
-    else ak = 0.25*ak*ak*ak;
-    return ak;
+    double x = ar2*(0.25*SPH_KERNEL_TABLE_SIZE);
+    int i = std::min((int) x, SPH_KERNEL_TABLE_SIZE);
+    double f = x - i;
+    return table[i] + f*(table[i+1] - table[i]);
     }
+
 /**
- * @brief dkernelM4 returns a scaled gradient of the M4 SPH kernel.
- * 
- * This returns a scaled version of the gradient of the Monaghan 1992 kernel
- * The kernel gradient gradW is defined as:
- *  gradW(q) = (1/(pi h^5)) (-3 + 9q/4) dx            for 0 < q < 1
- *  gradW(q) = -(1/(pi h^5)) (3/4) [(2-q)^2 /q] dx    for 1 < q < 2
- * For q = |dx|/h and dx is the particle separation (a vector)
- * NOTE: This function returns a scaled (and scalar) version of gradW
- * 
- * @param ar2 = q^2 = (|dx|/h)^2
- * @return (pi h^5/|dx|^2) (dx.dot.gradW)
+ * @brief KernelTable looks kernel K up in a table instead of
+ * evaluating it (bSPHKernelTable parameter).
+ *
+ * This avoids the sqrt() of the evaluation at the price of
+ * interpolation errors, largest in the gradient near the center.
  */
-inline double dkernelM4(double ar2)
-{
-    double adk;
-    adk = sqrt(ar2);
-    if (ar2 < 1.0) {
-	adk = -3 + 2.25*adk;
+template <class K> class KernelTable {
+ public:
+    static const int iType = K::iType;
+    static inline double kernel(double ar2) {
+	return sphKernelLookup(sphKernelTable[iType][0], ar2);
+	}
+    static inline double kernel0(int nSmooth) { return K::kernel0(nSmooth); }
+    static inline double dkernel(double ar2) {
+	return sphKernelLookup(sphKernelTable[iType][1], ar2);
 	}
-    else {
-	adk = -0.75*(2.0-adk)*(2.0-adk)/adk;
+};
+
+/// @brief Evaluate kernel K and the gradient of kernel DK over a
+/// list of neighbors.
+/// @param ar2 (|dx|/h)^2 of each neighbor, 0 for the particle itself
+/// @param rs set to the kernel
+/// @param rs1 set to the gradient
+template <class K, class DK>
+inline void kernelListPolicy(const double *ar2, double *rs, double *rs1,
+			     int n, int nSmooth)
+{
+    const double rs0 = K::kernel0(nSmooth);
+    for(int i = 0; i < n; i++) {
+	double w = K::kernel(ar2[i]);
+	rs[i] = (ar2[i] > 0.0) ? w : rs0;
+	rs1[i] = DK::dkernel(ar2[i]);
 	}
-    return adk;
     }
 
+void kernelList(const double *ar2, double *rs, double *rs1, int n,
+		int nSmooth);
+void initSphKernelTables();
+
 /**
  * @brief KERNEL returns a scaled version of the standard SPH kernel
  * 
  * This function is a wrapper around the various implemented SPH kernels.  
- * Kernels are chosen at compile time.
+ * Kernels are chosen at run time with the iSPHKernel parameter.
  * @param ar2 = q^2 = (|dx|/h)^2 for q = |dx|/h and dx is the particle 
  *  separation (a vector)
  * @param nSmooth is the number of neighbors used for SPH smoothing
  * @return KERNEL = (pi h^3) W
  */
 inline double KERNEL(double ar2, int nSmooth) {
-#if WENDLAND == 1
-    return kernelWendland(ar2, nSmooth);
-#elif M6KERNEL == 1
-    return kernelM6(ar2);
-#elif M4KERNEL == 1
-    return kernelM4(ar2);
-#else
-    #error No available kernel selected.
-#endif //KERNEL
+    int iKernel = iSphKernel;
+    if(iKernel >= SPH_KERNEL_WENDLAND_C2 && nSmooth < 32)
+	iKernel = SPH_KERNEL_M4;
+    if(ar2 <= 0.0) {
+	switch(iKernel) {
+	case SPH_KERNEL_WENDLAND_C2:
+	    return KernelWendlandC2::kernel0(nSmooth);
+	case SPH_KERNEL_WENDLAND_C4:
+	    return KernelWendlandC4::kernel0(nSmooth);
+	case SPH_KERNEL_WENDLAND_C6:
+	    return KernelWendlandC6::kernel0(nSmooth);
+	    }
+	}
+    if(bSphKernelTable)
+	return sphKernelLookup(sphKernelTable[iKernel][0], ar2);
+    switch(iKernel) {
+    case SPH_KERNEL_M6:
+	return KernelM6::kernel(ar2);
+    case SPH_KERNEL_WENDLAND_C2:
+	return KernelWendlandC2::kernel(ar2);
+    case SPH_KERNEL_WENDLAND_C4:
+	return KernelWendlandC4::kernel(ar2);
+    case SPH_KERNEL_WENDLAND_C6:
+	return KernelWendlandC6::kernel(ar2);
+    default:
+	return KernelM4::kernel(ar2);
+	}
 }
 
 /**
  * @brief DKERNEL returns a scaled gradient of the SPH kernel.
  * 
  * This function is a wrapper around the various implemented SPH kernels.  
- * Kernels are chosen at compile time.
+ * Kernels are chosen at run time with the iSPHKernel parameter.
  * @param ar2 = q^2 = (|dx|/h)^2 for q = |dx|/h and dx is the particle 
  *  separation (a vector)
  * @return DKERNEL = (pi h^5/|dx|^2) (dx.dot.gradW)  which is another way of
  * saying:  gradW = (1/(pi h^5)) DKERNEL * dx
  */
 inline double DKERNEL(double ar2) {
-#if WENDLAND == 1
-    return dkernelWendland(ar2);
-#elif M6KERNEL == 1
-    return dkernelM6(ar2);
-#elif M4KERNEL == 1
-    return dkernelM4(ar2);
-#else
-    #error No available kernel selected.
-#endif //KERNEL
+    if(bSphKernelTable)
+	return sphKernelLookup(sphKernelTable[iSphKernel][1], ar2);
+    switch(iSphKernel) {
+    case SPH_KERNEL_M6:
+	return KernelM6::dkernel(ar2);
+    case SPH_KERNEL_WENDLAND_C2:
+	return KernelWendlandC2::dkernel(ar2);
+    case SPH_KERNEL_WENDLAND_C4:
+	return KernelWendlandC4::dkernel(ar2);
+    case SPH_KERNEL_WENDLAND_C6:
+	return KernelWendlandC6::dkernel(ar2);
+    default:
+	return KernelM4::dkernel(ar2);
+	}
 }
 #endif
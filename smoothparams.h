@@ -1,8 +1,21 @@
 #ifndef __SMOOTHPARAMS_H
 #define __SMOOTHPARAMS_H
+#include <cstddef>
 class pqSmoothNode;
 class TreePiece;
 
+/// @brief A member of ExternalSmoothParticle written back by the
+/// smooth particle cache.
+struct SmoothCacheField {
+    int offset;         ///< byte offset in ExternalSmoothParticle
+    int size;           ///< size in bytes
+};
+
+/// Declare member f of ExternalSmoothParticle as a SmoothCacheField
+#define SMOOTH_CACHE_FIELD(f) \
+    { (int) offsetof(ExternalSmoothParticle, f), \
+      (int) sizeof(((ExternalSmoothParticle *) 0)->f) }
+
 /// @brief A base class from which parameters for all smooth
 /// operations can be derived.
 class SmoothParams : public PUP::able
@@ -12,6 +25,15 @@ class SmoothParams : public PUP::able
     int activeRung;     ///< Currently active rung
     TreePiece *tp;
     int bUseBallMax;    ///< limit fBall growth for bFastGas
+    /// Maximum distance any gas particle has drifted since the skin
+    /// was reset; negative if the skin is not in use, HUGE_VAL if
+    /// fSkinBall is to be recorded without bounding the search.
+    double dSkinDrift;
+    /// Safety factor on the predicted fBall used as the initial
+    /// search radius; 0 for no prediction.
+    double dBallPredict;
+    /// Base timestep for the fBall prediction
+    double dDeltaPredict;
     /// Function to apply to smooth particle and neighbors
     virtual void fcnSmooth(GravityParticle *p, int nSmooth, pqSmoothNode *nList) = 0;
     /// Particle is doing a neighbor search
@@ -37,16 +59,48 @@ class SmoothParams : public PUP::able
     /// in initSmoothCache() to avoid double counting.
     virtual void combSmoothCache(GravityParticle *p1,
 				 ExternalSmoothParticle *p2) = 0;
+    /// @brief Fields of ExternalSmoothParticle read by
+    /// combSmoothCache().  If declared, the cache writes back only
+    /// these fields, and only for particles where one of them was
+    /// changed by the smooth.  They must be set by
+    /// getExternalSmoothParticle() for the particles smoothed over.
+    /// @param nFields set to the number of fields
+    /// @return a static table of the fields, or NULL to write back
+    /// whole particles.
+    virtual const SmoothCacheField *smoothCacheFields(int &nFields) {
+	nFields = 0;
+	return NULL;
+	}
+    /// @brief Search radius of particle p in a fixed radius walk
+    /// (TreePiece::startBallSmooth()).  The default is fBall.
+    virtual double fBallQuery(GravityParticle *p);
+    /// @brief Number of neighbors after which a fixed radius walk
+    /// stops collecting for a particle; 0 for all within the radius.
+    virtual int nBallQueryMax() { return 0; }
     // limit ball growth by default
-    SmoothParams() { bUseBallMax = 1; tp = NULL; }
+    SmoothParams() {
+	bUseBallMax = 1;
+	dSkinDrift = -1.0;
+	dBallPredict = 0.0;
+	dDeltaPredict = 0.0;
+	tp = NULL;
+	}
     PUPable_abstract(SmoothParams);
-    SmoothParams(CkMigrateMessage *m) : PUP::able(m) { tp = NULL; }
+    SmoothParams(CkMigrateMessage *m) : PUP::able(m) {
+	tp = NULL;
+	dSkinDrift = -1.0;
+	dBallPredict = 0.0;
+	dDeltaPredict = 0.0;
+	}
     /// required method for remote entry call.
     virtual void pup(PUP::er &p) {
         PUP::able::pup(p);//Call base class
         p|iType;
         p|activeRung;
 	p|bUseBallMax;
+	p|dSkinDrift;
+	p|dBallPredict;
+	p|dDeltaPredict;
 	}
     };
 #endif
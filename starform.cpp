@@ -173,6 +173,7 @@ void Main::FormStars(double dTime, double dDelta)
     int *dCounts = (int *)msgCounts->getData();
     
     int nDelGas = dCounts[1];
+    nSink += dCounts[2];  // black holes are formed as sinks
     if(verbosity)
 	CkPrintf("%d Stars formed, %d gas deleted\n", dCounts[0], dCounts[1]);
     delete msgCounts;
@@ -210,6 +211,7 @@ void TreePiece::FormStars(Stfm stfm, double dTime,  double dDelta,
 {
     int nFormed = 0;
     int nDeleted = 0;
+    int nSinkFormed = 0;
     double dMassFormed = 0.0;
     double TempForm, H2FractionForm;
     
@@ -239,6 +241,8 @@ void TreePiece::FormStars(Stfm stfm, double dTime,  double dDelta,
 		dm->starLog->seTab.push_back(StarLogEvent(starp,dCosmoFac,TempForm));
 #endif
 		CmiUnlock(dm->lockStarLog);
+		if(TYPETest(starp, TYPE_SINK))
+		    nSinkFormed++;
 		delete (extraStarData *)starp->extraData;
 		delete starp;
 		if(TYPETest(p, TYPE_DELETED))
@@ -247,10 +251,11 @@ void TreePiece::FormStars(Stfm stfm, double dTime,  double dDelta,
 	    }
 	}
     
-    int counts[2];
+    int counts[3];
     counts[0] = nFormed;
     counts[1] = nDeleted;
-    contribute(2*sizeof(int), counts, CkReduction::sum_int, cb);
+    counts[2] = nSinkFormed;
+    contribute(3*sizeof(int), counts, CkReduction::sum_int, cb);
     }
 
 /*